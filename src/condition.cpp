@@ -0,0 +1,812 @@
+#include "condition.h"
+#include <ctype.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fmt/format.h>
+#include <smx/smx-typeinfo.h>
+#include "rtti.h"
+
+using namespace sp;
+
+namespace {
+
+/* low bits of a symbol's vclass: 0 global, 1 local, 2 static, 3 argument */
+const uint8_t kClassMask = 0x0f;
+
+/* past every function, so only globals are in scope */
+const cell_t kGlobalScope = -1;
+
+enum Token {
+	TokEnd,
+	TokNumber,
+	TokFloat,
+	TokString,
+	TokIdent,
+	TokOrOr,
+	TokAndAnd,
+	TokEq,
+	TokNe,
+	TokLe,
+	TokGe,
+	TokShl,
+	TokShr,
+	// Single characters are their own token.
+};
+
+struct Value {
+	enum Kind { Int, Float, Array, String } kind = Int;
+	cell_t i = 0;
+	float f = 0.f;
+	/* Array: address of the first element and the array's type, or no type
+	 * for arrays of symbols without RTTI. */
+	cell_t addr = 0;
+	const debug::Rtti* type = nullptr;
+	bool float_elems = false;
+	std::string s;
+
+	static Value Integer(cell_t v) {
+		Value value;
+		value.i = v;
+		return value;
+	}
+	static Value Real(float v) {
+		Value value;
+		value.kind = Float;
+		value.f = v;
+		return value;
+	}
+	float real() const {
+		return kind == Float ? f : static_cast<float>(i);
+	}
+	bool truth() const {
+		return kind == Float ? f != 0.f : i != 0;
+	}
+};
+
+} // namespace
+
+struct Condition::Node {
+	enum Op { Literal, Variable, Index, Unary, Binary } op;
+	int token = 0;
+	Value literal;
+	size_t slot = 0;
+	std::unique_ptr<Node> lhs, rhs;
+
+	explicit Node(Op op) : op(op) {
+	}
+};
+
+namespace {
+
+class Parser {
+public:
+	Parser(const std::string& source, std::vector<std::string>& names)
+		: p_(source.c_str()), names_(names) {
+		next();
+	}
+
+	std::unique_ptr<Condition::Node> parse(std::string* error) {
+		auto node = binary(1);
+		if (node && token_ != TokEnd)
+			fail("unexpected input");
+		if (!error_.empty()) {
+			*error = error_;
+			return nullptr;
+		}
+		return node;
+	}
+
+private:
+	static int precedence(int token) {
+		switch (token) {
+		case TokOrOr: return 1;
+		case TokAndAnd: return 2;
+		case '|': return 3;
+		case '^': return 4;
+		case '&': return 5;
+		case TokEq: case TokNe: return 6;
+		case '<': case '>': case TokLe: case TokGe: return 7;
+		case TokShl: case TokShr: return 8;
+		case '+': case '-': return 9;
+		case '*': case '/': case '%': return 10;
+		}
+		return 0;
+	}
+
+	std::unique_ptr<Condition::Node> binary(int min_prec) {
+		auto lhs = unary();
+		while (lhs) {
+			int op = token_;
+			int prec = precedence(op);
+			if (!prec || prec < min_prec)
+				break;
+			next();
+			auto rhs = binary(prec + 1);
+			if (!rhs)
+				return nullptr;
+			auto node = std::make_unique<Condition::Node>(Condition::Node::Binary);
+			node->token = op;
+			node->lhs = std::move(lhs);
+			node->rhs = std::move(rhs);
+			lhs = std::move(node);
+		}
+		return lhs;
+	}
+
+	std::unique_ptr<Condition::Node> unary() {
+		if (token_ == '-' || token_ == '!' || token_ == '~') {
+			int op = token_;
+			next();
+			auto operand = unary();
+			if (!operand)
+				return nullptr;
+			auto node = std::make_unique<Condition::Node>(Condition::Node::Unary);
+			node->token = op;
+			node->lhs = std::move(operand);
+			return node;
+		}
+		return postfix();
+	}
+
+	std::unique_ptr<Condition::Node> postfix() {
+		auto node = primary();
+		while (node && token_ == '[') {
+			next();
+			auto index = binary(1);
+			if (!index)
+				return nullptr;
+			if (token_ != ']')
+				return fail("expected ']'");
+			next();
+			auto indexed = std::make_unique<Condition::Node>(Condition::Node::Index);
+			indexed->lhs = std::move(node);
+			indexed->rhs = std::move(index);
+			node = std::move(indexed);
+		}
+		return node;
+	}
+
+	std::unique_ptr<Condition::Node> primary() {
+		std::unique_ptr<Condition::Node> node;
+		switch (token_) {
+		case TokNumber:
+		case TokFloat:
+		case TokString:
+			node = std::make_unique<Condition::Node>(Condition::Node::Literal);
+			node->literal = value_;
+			break;
+		case TokIdent:
+			if (text_ == "true" || text_ == "false") {
+				node = std::make_unique<Condition::Node>(Condition::Node::Literal);
+				node->literal = Value::Integer(text_ == "true");
+				break;
+			}
+			node = std::make_unique<Condition::Node>(Condition::Node::Variable);
+			node->slot = slot(text_);
+			break;
+		case '(':
+			next();
+			node = binary(1);
+			if (!node)
+				return nullptr;
+			if (token_ != ')')
+				return fail("expected ')'");
+			break;
+		default:
+			return fail("expected an expression");
+		}
+		next();
+		return node;
+	}
+
+	size_t slot(const std::string& name) {
+		for (size_t i = 0; i < names_.size(); i++) {
+			if (names_[i] == name)
+				return i;
+		}
+		names_.push_back(name);
+		return names_.size() - 1;
+	}
+
+	std::unique_ptr<Condition::Node> fail(const char* message) {
+		if (error_.empty())
+			error_ = message;
+		token_ = TokEnd;
+		return nullptr;
+	}
+
+	void next() {
+		while (isspace(static_cast<unsigned char>(*p_)))
+			p_++;
+		const char* start = p_;
+		char c = *p_;
+		if (!c) {
+			token_ = TokEnd;
+			return;
+		}
+		if (isdigit(static_cast<unsigned char>(c)) ||
+			(c == '.' && isdigit(static_cast<unsigned char>(p_[1])))) {
+			char* end;
+			long integer = strtol(start, &end, 0);
+			if (*end == '.' || *end == 'e' || *end == 'E') {
+				value_ = Value::Real(strtof(start, &end));
+				token_ = TokFloat;
+			}
+			else {
+				value_ = Value::Integer(static_cast<cell_t>(integer));
+				token_ = TokNumber;
+			}
+			p_ = end;
+			return;
+		}
+		if (isalpha(static_cast<unsigned char>(c)) || c == '_') {
+			while (isalnum(static_cast<unsigned char>(*p_)) || *p_ == '_')
+				p_++;
+			text_.assign(start, p_);
+			token_ = TokIdent;
+			return;
+		}
+		if (c == '"' || c == '\'') {
+			std::string text;
+			p_++;
+			while (*p_ && *p_ != c) {
+				if (*p_ == '\\' && p_[1])
+					p_++;
+				text += *p_++;
+			}
+			if (*p_ != c) {
+				fail("unterminated literal");
+				return;
+			}
+			p_++;
+			if (c == '\'') {
+				if (text.size() != 1) {
+					fail("bad character literal");
+					return;
+				}
+				value_ = Value::Integer(static_cast<unsigned char>(text[0]));
+				token_ = TokNumber;
+			}
+			else {
+				value_ = Value();
+				value_.kind = Value::String;
+				value_.s = text;
+				token_ = TokString;
+			}
+			return;
+		}
+
+		static const struct {
+			const char* text;
+			Token token;
+		} pairs[] = {
+			{ "||", TokOrOr }, { "&&", TokAndAnd }, { "==", TokEq },
+			{ "!=", TokNe }, { "<=", TokLe }, { ">=", TokGe },
+			{ "<<", TokShl }, { ">>", TokShr },
+		};
+		for (auto& pair : pairs) {
+			if (!strncmp(p_, pair.text, 2)) {
+				p_ += 2;
+				token_ = pair.token;
+				return;
+			}
+		}
+		if (strchr("+-*/%<>&|^!~()[]", c)) {
+			p_++;
+			token_ = c;
+			return;
+		}
+		fail("unexpected character");
+	}
+
+	const char* p_;
+	std::vector<std::string>& names_;
+	int token_ = TokEnd;
+	Value value_;
+	std::string text_;
+	std::string error_;
+};
+
+class Evaluator {
+public:
+	Evaluator(SourcePawn::IPluginContext* ctx, cell_t frm,
+		const std::vector<Condition::Binding>& bindings)
+		: ctx_(ctx), frm_(frm), bindings_(bindings) {
+	}
+
+	bool eval(const Condition::Node* node, Value* out) {
+		switch (node->op) {
+		case Condition::Node::Literal:
+			*out = node->literal;
+			return true;
+		case Condition::Node::Variable:
+			return variable(bindings_[node->slot], out);
+		case Condition::Node::Index:
+		{
+			Value array, index;
+			if (!eval(node->lhs.get(), &array) || !eval(node->rhs.get(), &index))
+				return false;
+			if (array.kind != Value::Array)
+				return fail("only arrays can be indexed");
+			if (index.kind != Value::Int)
+				return fail("array index must be an integer");
+			return element(array, index.i, out);
+		}
+		case Condition::Node::Unary:
+		{
+			Value operand;
+			if (!eval(node->lhs.get(), &operand) || !numeric(operand))
+				return false;
+			if (node->token == '!')
+				*out = Value::Integer(!operand.truth());
+			else if (node->token == '-')
+				*out = operand.kind == Value::Float ? Value::Real(-operand.f)
+					: Value::Integer((cell_t)(0u - (uint32_t)operand.i));
+			else if (operand.kind == Value::Int)
+				*out = Value::Integer(~operand.i);
+			else
+				return fail("'~' needs an integer");
+			return true;
+		}
+		case Condition::Node::Binary:
+			return binary(node, out);
+		}
+		return false;
+	}
+
+	bool text(const Value& value, std::string* out) {
+		if (value.kind == Value::String) {
+			*out = value.s;
+			return true;
+		}
+		if (value.kind != Value::Array)
+			return fail("only arrays compare against strings");
+		char* str;
+		if (ctx_->LocalToStringNULL(value.addr, &str) != SP_ERROR_NONE)
+			return fail("invalid address");
+		*out = str ? str : "";
+		return true;
+	}
+
+	// Resolves a global variable, an element of one or a one-dimensional
+	// global array to the range of plugin memory it occupies.
+	bool locate(const Condition::Node* node, cell_t* addr, cell_t* size) {
+		if (node->op == Condition::Node::Variable) {
+			auto& binding = bindings_[node->slot];
+			if (binding.local)
+				return fail("only globals can be watched");
+			*addr = binding.sym->addr();
+			if (!binding.is_array) {
+				*size = sizeof(cell_t);
+				return true;
+			}
+			auto type = binding.type;
+			if (!type || type->type() != cb::kFixedArray || !type->inner() ||
+				type->inner()->type() == cb::kFixedArray ||
+				type->inner()->type() == cb::kArray ||
+				type->inner()->type() == cb::kEnumStruct)
+				return fail("watch an element of this array instead");
+			if (type->inner()->type() == cb::kChar8)
+				*size = (type->index() + sizeof(cell_t) - 1) & ~(sizeof(cell_t) - 1);
+			else
+				*size = type->index() * sizeof(cell_t);
+			return true;
+		}
+		if (node->op != Condition::Node::Index)
+			return fail("only variables and array elements can be watched");
+
+		Value array, index;
+		if (!eval(node->lhs.get(), &array) || !eval(node->rhs.get(), &index))
+			return false;
+		if (array.kind != Value::Array)
+			return fail("only arrays can be indexed");
+		if (index.kind != Value::Int)
+			return fail("array index must be an integer");
+		if (index.i < 0)
+			return fail("array index out of bounds");
+		auto type = array.type;
+		if (type && type->type() != cb::kEnumStruct) {
+			auto inner = type->inner();
+			if (!inner)
+				return fail("not an array");
+			if (type->type() == cb::kFixedArray && static_cast<uint32_t>(index.i) >= type->index())
+				return fail("array index out of bounds");
+			switch (inner->type()) {
+			case cb::kChar8:
+				*addr = array.addr + index.i;
+				*size = 1;
+				return true;
+			case cb::kFixedArray:
+			case cb::kArray:
+			case cb::kEnumStruct:
+				return fail("watch an element of this array instead");
+			}
+		}
+		*addr = array.addr + index.i * sizeof(cell_t);
+		*size = sizeof(cell_t);
+		return true;
+	}
+
+	std::string error;
+
+private:
+	bool binary(const Condition::Node* node, Value* out) {
+		Value lhs, rhs;
+		if (!eval(node->lhs.get(), &lhs))
+			return false;
+		if (node->token == TokAndAnd || node->token == TokOrOr) {
+			if (!numeric(lhs))
+				return false;
+			bool truth = lhs.truth();
+			if (truth == (node->token == TokOrOr)) {
+				*out = Value::Integer(truth);
+				return true;
+			}
+			if (!eval(node->rhs.get(), &rhs) || !numeric(rhs))
+				return false;
+			*out = Value::Integer(rhs.truth());
+			return true;
+		}
+		if (!eval(node->rhs.get(), &rhs))
+			return false;
+
+		/* strings: arrays compared by content against a literal */
+		if (lhs.kind == Value::String || rhs.kind == Value::String) {
+			if (node->token != TokEq && node->token != TokNe)
+				return fail("strings can only be compared with == and !=");
+			std::string a, b;
+			if (!text(lhs, &a) || !text(rhs, &b))
+				return false;
+			*out = Value::Integer((a == b) == (node->token == TokEq));
+			return true;
+		}
+		if (!numeric(lhs) || !numeric(rhs))
+			return false;
+
+		if (lhs.kind == Value::Float || rhs.kind == Value::Float) {
+			float a = lhs.real(), b = rhs.real();
+			switch (node->token) {
+			case '+': *out = Value::Real(a + b); return true;
+			case '-': *out = Value::Real(a - b); return true;
+			case '*': *out = Value::Real(a * b); return true;
+			case '/': *out = Value::Real(a / b); return true;
+			case '<': *out = Value::Integer(a < b); return true;
+			case '>': *out = Value::Integer(a > b); return true;
+			case TokLe: *out = Value::Integer(a <= b); return true;
+			case TokGe: *out = Value::Integer(a >= b); return true;
+			case TokEq: *out = Value::Integer(a == b); return true;
+			case TokNe: *out = Value::Integer(a != b); return true;
+			}
+			return fail("operator needs integers");
+		}
+
+		/* wrap like the VM does, in unsigned arithmetic to stay defined */
+		cell_t a = lhs.i, b = rhs.i;
+		uint32_t ua = (uint32_t)a, ub = (uint32_t)b;
+		switch (node->token) {
+		case '+': *out = Value::Integer((cell_t)(ua + ub)); return true;
+		case '-': *out = Value::Integer((cell_t)(ua - ub)); return true;
+		case '*': *out = Value::Integer((cell_t)(ua * ub)); return true;
+		case '/':
+		case '%':
+			if (!b)
+				return fail("division by zero");
+			if (a == INT_MIN && b == -1)
+				return fail("integer overflow");
+			*out = Value::Integer(node->token == '/' ? a / b : a % b);
+			return true;
+		case TokShl: *out = Value::Integer((cell_t)(ua << (ub & 31))); return true;
+		case TokShr: *out = Value::Integer(a >> (ub & 31)); return true;
+		case '&': *out = Value::Integer(a & b); return true;
+		case '|': *out = Value::Integer(a | b); return true;
+		case '^': *out = Value::Integer(a ^ b); return true;
+		case '<': *out = Value::Integer(a < b); return true;
+		case '>': *out = Value::Integer(a > b); return true;
+		case TokLe: *out = Value::Integer(a <= b); return true;
+		case TokGe: *out = Value::Integer(a >= b); return true;
+		case TokEq: *out = Value::Integer(a == b); return true;
+		case TokNe: *out = Value::Integer(a != b); return true;
+		}
+		return fail("unknown operator");
+	}
+
+	bool variable(const Condition::Binding& binding, Value* out) {
+		cell_t addr = binding.local ? binding.sym->addr() + frm_ : binding.sym->addr();
+		if (binding.by_ref && !read(addr, &addr))
+			return false;
+		if (binding.is_array) {
+			*out = Value();
+			out->kind = Value::Array;
+			out->addr = addr;
+			out->type = binding.type;
+			out->float_elems = binding.is_float;
+			return true;
+		}
+		cell_t cell;
+		if (!read(addr, &cell))
+			return false;
+		*out = binding.is_float ? Value::Real(sp_ctof(cell)) : Value::Integer(cell);
+		return true;
+	}
+
+	bool element(const Value& array, cell_t index, Value* out) {
+		if (index < 0)
+			return fail("array index out of bounds");
+		if (!array.type) {
+			/* symbol without RTTI: a plain one-dimensional array */
+			cell_t cell;
+			if (!read(array.addr + index * sizeof(cell_t), &cell))
+				return false;
+			*out = array.float_elems ? Value::Real(sp_ctof(cell)) : Value::Integer(cell);
+			return true;
+		}
+
+		auto type = array.type;
+		if (type->type() == cb::kEnumStruct) {
+			cell_t cell;
+			if (!read(array.addr + index * sizeof(cell_t), &cell))
+				return false;
+			*out = Value::Integer(cell);
+			return true;
+		}
+		auto inner = type->inner();
+		if (!inner)
+			return fail("not an array");
+		if (type->type() == cb::kFixedArray && static_cast<uint32_t>(index) >= type->index())
+			return fail("array index out of bounds");
+
+		switch (inner->type()) {
+		case cb::kChar8:
+		{
+			cell_t* ptr;
+			if (ctx_->LocalToPhysAddr(array.addr + index, &ptr) != SP_ERROR_NONE)
+				return fail("invalid address");
+			*out = Value::Integer(*reinterpret_cast<const char*>(ptr));
+			return true;
+		}
+		case cb::kFixedArray:
+		case cb::kArray:
+		case cb::kEnumStruct:
+		{
+			/* sub-arrays hang off an indirection vector of relative offsets */
+			cell_t slot = array.addr + index * sizeof(cell_t);
+			cell_t offset;
+			if (!read(slot, &offset))
+				return false;
+			*out = Value();
+			out->kind = Value::Array;
+			out->addr = slot + offset;
+			out->type = inner;
+			return true;
+		}
+		}
+		cell_t cell;
+		if (!read(array.addr + index * sizeof(cell_t), &cell))
+			return false;
+		*out = inner->type() == cb::kFloat32 ? Value::Real(sp_ctof(cell)) : Value::Integer(cell);
+		return true;
+	}
+
+	bool numeric(const Value& value) {
+		if (value.kind == Value::Int || value.kind == Value::Float)
+			return true;
+		return fail(value.kind == Value::Array ? "array used as a number" : "string used as a number");
+	}
+
+	bool read(cell_t addr, cell_t* out) {
+		cell_t* ptr;
+		if (ctx_->LocalToPhysAddr(addr, &ptr) != SP_ERROR_NONE)
+			return fail("invalid address");
+		*out = *ptr;
+		return true;
+	}
+
+	bool fail(const char* message) {
+		if (error.empty())
+			error = message;
+		return false;
+	}
+
+	SourcePawn::IPluginContext* ctx_;
+	cell_t frm_;
+	const std::vector<Condition::Binding>& bindings_;
+};
+
+} // namespace
+
+Condition::~Condition() = default;
+
+std::unique_ptr<Condition> Condition::Parse(const std::string& source,
+	std::string* error) {
+	std::unique_ptr<Condition> condition(new Condition);
+	Parser parser(source, condition->names_);
+	condition->root_ = parser.parse(error);
+	if (!condition->root_)
+		return nullptr;
+	condition->source_ = source;
+	return condition;
+}
+
+bool Condition::bind(const std::shared_ptr<SmxV1Image>& image, cell_t cip,
+	std::vector<Binding>** bindings, std::string* error) {
+	if (image != image_) {
+		/* symbols belong to the image they were found in */
+		bindings_.clear();
+		image_ = image;
+	}
+	auto found = bindings_.find(cip);
+	if (found != bindings_.end()) {
+		*bindings = &found->second;
+		return true;
+	}
+
+	std::vector<Binding> bound;
+	for (auto& name : names_) {
+		auto sym = image_->FindVariable(name.c_str(), cip);
+		if (!sym) {
+			*error = "unknown symbol '" + name + "'";
+			return false;
+		}
+		Binding binding = { sym, nullptr, false, false, false, false };
+		uint8_t vclass = sym->vclass() & kClassMask;
+		binding.local = vclass == 1 || vclass == 3;
+
+		auto rtti = sym->rtti();
+		if (rtti && rtti->type_id) {
+			auto type = image_->rtti_data()->typeFromTypeId(rtti->type_id);
+			if (!type) {
+				*error = "no type for '" + name + "'";
+				return false;
+			}
+			switch (type->type()) {
+			case cb::kArray:
+				binding.by_ref = vclass == 3;
+				// fallthrough
+			case cb::kFixedArray:
+			case cb::kEnumStruct:
+				binding.is_array = true;
+				binding.type = type;
+				break;
+			case cb::kFloat32:
+				binding.is_float = true;
+				break;
+			}
+		}
+		else {
+			binding.by_ref = sym->ident() == sp::IDENT_REFERENCE ||
+				sym->ident() == sp::IDENT_REFARRAY;
+			binding.is_array = sym->ident() == sp::IDENT_ARRAY ||
+				sym->ident() == sp::IDENT_REFARRAY;
+			auto tagname = image_->GetTagName(sym->tagid());
+			binding.is_float = tagname &&
+				(!strcmp(tagname, "Float") || !strcmp(tagname, "float"));
+		}
+		bound.push_back(binding);
+	}
+	*bindings = &bindings_.emplace(cip, std::move(bound)).first->second;
+	return true;
+}
+
+bool Condition::Evaluate(const std::shared_ptr<SmxV1Image>& image,
+	SourcePawn::IPluginContext* ctx, cell_t cip, cell_t frm,
+	bool* result, std::string* error) {
+	std::vector<Binding>* bindings;
+	if (!bind(image, cip, &bindings, error))
+		return false;
+
+	Evaluator evaluator(ctx, frm, *bindings);
+	Value value;
+	if (!evaluator.eval(root_.get(), &value)) {
+		*error = evaluator.error;
+		return false;
+	}
+	if (value.kind == Value::String || value.kind == Value::Array) {
+		*error = "condition is not a number";
+		return false;
+	}
+	*result = value.truth();
+	return true;
+}
+
+bool Condition::Locate(const std::shared_ptr<SmxV1Image>& image,
+	SourcePawn::IPluginContext* ctx, cell_t* addr, cell_t* size,
+	std::string* error) {
+	std::vector<Binding>* bindings;
+	if (!bind(image, kGlobalScope, &bindings, error))
+		return false;
+
+	Evaluator evaluator(ctx, 0, *bindings);
+	if (!evaluator.locate(root_.get(), addr, size)) {
+		*error = evaluator.error;
+		return false;
+	}
+	return true;
+}
+
+bool Condition::Print(const std::shared_ptr<SmxV1Image>& image,
+	SourcePawn::IPluginContext* ctx, cell_t cip, cell_t frm,
+	std::string* text, std::string* error) {
+	std::vector<Binding>* bindings;
+	if (!bind(image, cip, &bindings, error))
+		return false;
+
+	Evaluator evaluator(ctx, frm, *bindings);
+	Value value;
+	if (!evaluator.eval(root_.get(), &value) ||
+		(value.kind == Value::Array && !evaluator.text(value, text))) {
+		*error = evaluator.error;
+		return false;
+	}
+	switch (value.kind) {
+	case Value::Int:
+		*text = std::to_string(value.i);
+		break;
+	case Value::Float:
+		*text = fmt::format("{}", value.f);
+		break;
+	case Value::String:
+		*text = value.s;
+		break;
+	case Value::Array:
+		break;
+	}
+	return true;
+}
+
+bool Condition::PrintGlobal(const std::shared_ptr<SmxV1Image>& image,
+	SourcePawn::IPluginContext* ctx, std::string* text, std::string* error) {
+	return Print(image, ctx, kGlobalScope, 0, text, error);
+}
+
+std::unique_ptr<LogMessage> LogMessage::Parse(const std::string& source,
+	std::string* error) {
+	std::unique_ptr<LogMessage> message(new LogMessage);
+	std::string text;
+	for (size_t i = 0; i < source.size(); i++) {
+		char c = source[i];
+		if ((c == '{' || c == '}') && i + 1 < source.size() && source[i + 1] == c) {
+			text += c;
+			i++;
+			continue;
+		}
+		if (c == '}') {
+			*error = "unmatched '}'";
+			return nullptr;
+		}
+		if (c != '{') {
+			text += c;
+			continue;
+		}
+		size_t end = source.find('}', i);
+		if (end == std::string::npos) {
+			*error = "unmatched '{'";
+			return nullptr;
+		}
+		auto expr = Condition::Parse(source.substr(i + 1, end - i - 1), error);
+		if (!expr)
+			return nullptr;
+		message->parts_.push_back({ std::move(text), std::move(expr) });
+		text.clear();
+		i = end;
+	}
+	if (!text.empty())
+		message->parts_.push_back({ std::move(text), nullptr });
+	return message;
+}
+
+std::string LogMessage::Format(const std::shared_ptr<SmxV1Image>& image,
+	SourcePawn::IPluginContext* ctx, cell_t cip, cell_t frm) {
+	std::string out;
+	for (auto& part : parts_) {
+		out += part.text;
+		if (!part.expr)
+			continue;
+		std::string value, error;
+		if (part.expr->Print(image, ctx, cip, frm, &value, &error))
+			out += value;
+		else
+			out += "<error>";
+	}
+	return out;
+}
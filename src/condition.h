@@ -0,0 +1,137 @@
+#pragma once
+
+#ifndef _INCLUDE_CONDITION_H_
+#define _INCLUDE_CONDITION_H_
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <sp_vm_api.h>
+#include "smx-v1-image.h"
+
+/**
+ * @brief Breakpoint condition, e.g. "client == 3 && health[client] < 10.0".
+ *
+ * The source is parsed once into an expression tree. Identifiers are bound
+ * to the symbols visible at a code address the first time the condition is
+ * evaluated there, and values are read straight from plugin memory, so a
+ * hit that does not match costs no round trip to the client.
+ *
+ * Supports integer, float, char and string literals, true/false, variables,
+ * array indexing, unary - ! ~ and the binary C operators from * to ||.
+ * Arrays compare against string literals by content.
+ */
+class Condition {
+public:
+	struct Node;
+
+	~Condition();
+
+	/**
+	 * @brief Parses a condition.
+	 *
+	 * @param source  Condition text.
+	 * @param error   Receives a description of the problem on failure.
+	 * @return        The condition, or nullptr on a syntax error.
+	 */
+	static std::unique_ptr<Condition> Parse(const std::string& source,
+		std::string* error);
+
+	/**
+	 * @brief Evaluates the condition at a break. Game thread only.
+	 *
+	 * @param image   Image of the stopped plugin.
+	 * @param ctx     Context of the stopped plugin.
+	 * @param cip     Code address of the break, selects the visible symbols.
+	 * @param frm     Frame of the break, locals are relative to it.
+	 * @param result  Receives the truth value.
+	 * @param error   Receives a description of the problem on failure.
+	 * @return        False if the condition could not be evaluated.
+	 */
+	bool Evaluate(const std::shared_ptr<sp::SmxV1Image>& image,
+		SourcePawn::IPluginContext* ctx, cell_t cip, cell_t frm,
+		bool* result, std::string* error);
+
+	/**
+	 * @brief Evaluates the condition as an expression and formats its value.
+	 *
+	 * Numbers print in decimal, arrays print as the string they hold.
+	 *
+	 * @param text    Receives the formatted value.
+	 * @return        False if the expression could not be evaluated.
+	 */
+	bool Print(const std::shared_ptr<sp::SmxV1Image>& image,
+		SourcePawn::IPluginContext* ctx, cell_t cip, cell_t frm,
+		std::string* text, std::string* error);
+
+	/**
+	 * @brief Resolves the condition to the plugin memory it names, e.g.
+	 * "g_iScore[5]". Indexes are evaluated once, here.
+	 *
+	 * @param addr    Receives the plugin address.
+	 * @param size    Receives the size in bytes.
+	 * @return        False unless the expression is a global variable, an
+	 *                element of one or a one-dimensional global array.
+	 */
+	bool Locate(const std::shared_ptr<sp::SmxV1Image>& image,
+		SourcePawn::IPluginContext* ctx, cell_t* addr, cell_t* size,
+		std::string* error);
+
+	/* Evaluates and formats at global scope, for expressions given to Locate. */
+	bool PrintGlobal(const std::shared_ptr<sp::SmxV1Image>& image,
+		SourcePawn::IPluginContext* ctx, std::string* text, std::string* error);
+
+	const std::string& source() const {
+		return source_;
+	}
+
+	/* an identifier resolved against the symbols visible at one address */
+	struct Binding {
+		sp::SmxV1Image::Symbol* sym;
+		const sp::debug::Rtti* type;
+		bool local;
+		bool by_ref;
+		bool is_float;
+		bool is_array;
+	};
+
+private:
+	Condition() = default;
+	bool bind(const std::shared_ptr<sp::SmxV1Image>& image, cell_t cip,
+		std::vector<Binding>** bindings, std::string* error);
+
+	std::string source_;
+	std::unique_ptr<Node> root_;
+	std::vector<std::string> names_;
+	std::shared_ptr<sp::SmxV1Image> image_;
+	std::unordered_map<cell_t, std::vector<Binding>> bindings_;
+};
+
+/**
+ * @brief Log point message, e.g. "client={client} health={health[client]}".
+ *
+ * Text between braces is an expression as accepted by Condition and is
+ * replaced by its value; "{{" and "}}" stand for literal braces.
+ */
+class LogMessage {
+public:
+	static std::unique_ptr<LogMessage> Parse(const std::string& source,
+		std::string* error);
+
+	/**
+	 * @brief Formats the message at a break. Game thread only.
+	 *
+	 * Expressions that fail to evaluate print as "<error>".
+	 */
+	std::string Format(const std::shared_ptr<sp::SmxV1Image>& image,
+		SourcePawn::IPluginContext* ctx, cell_t cip, cell_t frm);
+
+private:
+	struct Part {
+		std::string text;
+		std::unique_ptr<Condition> expr;
+	};
+	std::vector<Part> parts_;
+};
+
+#endif //_INCLUDE_CONDITION_H_
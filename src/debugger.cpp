@@ -2,6 +2,7 @@
 #include <assert.h>
 #include <ctype.h>
 #include <deque>
+#include <map>
 #include <setjmp.h>
 #include <signal.h>
 #include <sstream>
@@ -11,10 +12,17 @@
 #include <time.h>
 #include <vector>
 #include "utlbuffer.h"
+#include "condition.h"
+#include "watchpoint.h"
 #include <fstream>
 #include <unordered_map>
 #include <unordered_set>
 #include <mutex>
+#include <atomic>
+#include <future>
+#include <thread>
+#include <zlib.h>
+#include <tuple>
 #include <filesystem>
 #include <fmt/printf.h>
 
@@ -28,6 +36,7 @@
 #include <brynet/net/wrapper/ServiceBuilder.hpp>
 
 #include "sourcepawn/include/sp_vm_types.h"
+#include <smx/smx-v1-opcodes.h>
 #include <nlohmann/json.hpp>
 
 using namespace sp;
@@ -72,6 +81,9 @@ enum MessageType {
 	ClearBreakpoints,
 	SetBreakpoint,
 
+	// reason, description, text. With DebuggerSoftStop the reason is
+	// "paused" and the description carries the cause: the frame already
+	// ran on, so locals are a read-only snapshot, not live values.
 	HasStopped,
 	HasContinued,
 
@@ -88,9 +100,69 @@ enum MessageType {
 	Evaluate,
 
 	Disconnect,
+
+	RequestSnapshot,
+	Snapshot,
+
+	RequestVariablesDelta,
+	VariablesDelta,
+	ResyncVariables,
+
+	RequestVariableSlice,
+	VariableSlice,
+
+	RequestCapabilities,
+	Capabilities,
+
+	Output,
+
+	SetDataBreakpoint,
+	ClearDataBreakpoints,
 	TotalMessages
 };
 
+// Optional protocol features. A client asks for them with
+// RequestCapabilities and gets back the subset the server enabled.
+enum Capability : uint32_t {
+	// Variable values are sent as ValueTag-encoded binary instead of text.
+	CapBinaryValues = 1 << 0,
+	// Payloads above DebuggerCompressThreshold may be zlib compressed.
+	CapCompression = 1 << 1,
+	// SetDataBreakpoint works; needs a runtime that instruments stores.
+	CapDataBreakpoints = 1 << 2,
+	// Evaluate's frameId and "N:" scope prefixes pick a CallStack frame;
+	// without it they always mean the frame the plugin stopped in.
+	CapFrameIndex = 1 << 3,
+	// Arrays and structs are sent as a handle and a child count, paged with
+	// RequestVariableSlice; each variable entry ends in handle, children
+	// instead of the single reserved int. Without it they render inline.
+	CapVariableHandles = 1 << 4,
+};
+static const uint32_t kServerCapabilities = CapBinaryValues | CapCompression |
+	CapFrameIndex | CapVariableHandles;
+
+// Leading byte of a binary encoded value.
+enum ValueTag : uint8_t {
+	ValueText = 0, // rendered text, as without CapBinaryValues
+	ValueCell,     // one int32 cell
+	ValueBool,     // one cell, zero or non-zero
+	ValueFloat,    // one float32 cell
+	ValueString,   // char8 bytes without terminator
+	ValueCells,    // raw cells; the RTTI type names the element type
+};
+
+// Every message is framed as a uint32 payload length and a uint8 type.
+static const size_t kFrameHeaderSize = 5;
+static const size_t kMaxRecvBufferSize = 1024 * 1024;
+
+// Set on the type byte of a compressed frame. The payload then starts with
+// its inflated size as a uint32, followed by the zlib stream.
+static const uint8_t kCompressedFlag = 0x80;
+static const size_t kMaxInflatedSize = 64 * 1024 * 1024;
+
+// Log point messages kept per client and tick; the rest are counted.
+static const size_t kMaxOutputPerTick = 1000;
+
 std::vector<std::string> split_string(const std::string& str,
 	const std::string& delimiter) {
 	std::vector<std::string> strings;
@@ -109,6 +181,455 @@ std::vector<std::string> split_string(const std::string& str,
 }
 DebugReport DebugListener;
 void removeClientID(const TcpConnection::Ptr& session);
+void RebuildBreakpointMaps();
+void ApplyDataWatchRanges();
+IPluginRuntime* FindRuntimeByFile(const std::string& filename,
+	std::shared_ptr<SmxV1Image>* image);
+void InvalidateSubscriptions();
+void OnImageReady(IPluginRuntime* runtime, uint64_t serial,
+	const std::shared_ptr<SmxV1Image>& image);
+
+class BreakpointMap;
+
+// Break bookkeeping of one plugin, in a table indexed by the slot the VM
+// reports with each break, so the break path reaches it without a lookup.
+// Game thread only.
+struct context_state_s {
+	IPluginContext* ctx = nullptr;
+	BreakpointMap* map = nullptr;
+	/* line of the last break, so the other BREAKs of a line don't stop */
+	uint32_t lastline = 0;
+};
+static std::vector<context_state_s> context_states;
+/* set when the runtime reports context slots with each break */
+static bool context_slots = false;
+
+/* Runtimes without context slots share slot 0, as all plugins once did. */
+context_state_s& ContextState(IPluginContext* ctx,
+	const sp_debug_break_info_t& info) {
+	uint32_t slot = context_slots
+		? static_cast<const sp_debug_break_info_ex_t&>(info).context_slot : 0;
+	if (slot >= context_states.size())
+		context_states.resize(slot + 1);
+	auto& state = context_states[slot];
+	if (state.ctx != ctx) {
+		state = context_state_s();
+		state.ctx = ctx;
+	}
+	return state;
+}
+
+void ResetContextState(IPluginContext* ctx) {
+	for (auto& state : context_states) {
+		if (state.ctx == ctx)
+			state = context_state_s();
+	}
+}
+
+/* plugins left frozen by clients that went away, resumed on the next frame */
+static std::mutex thaw_mtx;
+static std::vector<IPlugin*> thaw_plugins;
+
+/* Reads and validates a plugin image, nullptr if it can't be used. */
+std::shared_ptr<SmxV1Image> LoadImage(const char* filename,
+	SmxV1Image::Validation mode = SmxV1Image::Validation::Lazy) {
+	FILE* fp = fopen(filename, "rb");
+	if (!fp)
+		return nullptr;
+	auto loaded = std::make_shared<SmxV1Image>(fp, filename);
+	fclose(fp);
+	if (!loaded->validate(mode))
+		return nullptr;
+	return loaded;
+}
+
+//
+//  Validated images of loaded plugins, keyed by runtime. Images are loaded
+//  when the plugin loads, inline or on a background thread, so a break only
+//  costs a pointer lookup (and at worst a wait for a pending validation).
+//  Inline loads validate lazily; the worker validates everything up front.
+//
+class ImageCache {
+public:
+	~ImageCache() {
+		StopWorker();
+	}
+
+	void StartWorker() {
+		std::lock_guard<std::mutex> lock(mtx_);
+		if (worker_.joinable())
+			return;
+		stop_ = false;
+		worker_ = std::thread(&ImageCache::WorkerLoop, this);
+	}
+
+	void StopWorker() {
+		{
+			std::lock_guard<std::mutex> lock(mtx_);
+			stop_ = true;
+		}
+		cv_.notify_one();
+		if (worker_.joinable())
+			worker_.join();
+	}
+
+	void Add(IPluginRuntime* runtime) {
+		auto job = std::make_shared<Job>();
+		job->runtime = runtime;
+		job->filename = runtime->GetFilename();
+		job->image = job->promise.get_future().share();
+		{
+			std::lock_guard<std::mutex> lock(mtx_);
+			job->serial = ++serial_;
+			entries_[runtime] = job;
+			if (worker_.joinable()) {
+				queue_.push_back(job);
+				cv_.notify_one();
+				return;
+			}
+		}
+		Run(job, SmxV1Image::Validation::Lazy);
+	}
+
+	void Remove(IPluginRuntime* runtime) {
+		std::lock_guard<std::mutex> lock(mtx_);
+		entries_.erase(runtime);
+	}
+
+	/* Waits for a pending validation. Plugins that slipped past Add are loaded inline. */
+	std::shared_ptr<SmxV1Image> Find(IPluginRuntime* runtime) {
+		std::shared_future<std::shared_ptr<SmxV1Image>> image;
+		{
+			std::lock_guard<std::mutex> lock(mtx_);
+			auto found = entries_.find(runtime);
+			if (found != entries_.end())
+				image = found->second->image;
+		}
+		if (!image.valid()) {
+			Add(runtime);
+			return Find(runtime);
+		}
+		return image.get();
+	}
+
+	/* False once the runtime was unloaded or loaded again. */
+	bool IsCurrent(IPluginRuntime* runtime, uint64_t serial) {
+		std::lock_guard<std::mutex> lock(mtx_);
+		auto found = entries_.find(runtime);
+		return found != entries_.end() && found->second->serial == serial;
+	}
+
+private:
+	struct Job {
+		IPluginRuntime* runtime;
+		uint64_t serial;
+		std::string filename;
+		std::promise<std::shared_ptr<SmxV1Image>> promise;
+		std::shared_future<std::shared_ptr<SmxV1Image>> image;
+	};
+
+	void Run(const std::shared_ptr<Job>& job, SmxV1Image::Validation mode) {
+		auto image = LoadImage(job->filename.c_str(), mode);
+		job->promise.set_value(image);
+		OnImageReady(job->runtime, job->serial, image);
+	}
+
+	void WorkerLoop() {
+		std::unique_lock<std::mutex> lock(mtx_);
+		while (true) {
+			cv_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+			if (stop_)
+				break;
+			auto job = queue_.front();
+			queue_.pop_front();
+			lock.unlock();
+			Run(job, SmxV1Image::Validation::Eager);
+			lock.lock();
+		}
+		/* don't leave anyone waiting on an image that will never come */
+		for (auto& job : queue_) {
+			job->promise.set_value(nullptr);
+		}
+		queue_.clear();
+	}
+
+	std::mutex mtx_;
+	std::condition_variable cv_;
+	std::unordered_map<IPluginRuntime*, std::shared_ptr<Job>> entries_;
+	std::deque<std::shared_ptr<Job>> queue_;
+	std::thread worker_;
+	uint64_t serial_ = 0;
+	bool stop_ = false;
+};
+
+ImageCache image_cache;
+
+typedef std::unordered_map<std::string, std::unordered_set<long>> BreakList;
+/* code addresses a step is waiting for, by plugin */
+typedef std::vector<std::pair<IPluginRuntime*, const std::vector<cell_t>*>> TrapList;
+
+//
+//  Cip-indexed bitmap of armed breakpoint addresses of a single plugin.
+//  DebugHandler tests one bit per BREAK opcode and only enters the full
+//  DebugHook when the bit is set.
+//
+//  With a patchable runtime the same bits are mirrored into the JIT, so
+//  unarmed BREAK sites never leave plugin code at all.
+//
+//  Step over and step out arm the lines they may land on as one-shot
+//  traps in the same bitmap, so the code in between runs at full speed.
+//
+class BreakpointMap {
+public:
+	BreakpointMap(IPluginRuntime* runtime, std::shared_ptr<SmxV1Image> image)
+		: runtime_(runtime), image_(std::move(image)) {
+		if (image_)
+			cells_ = image_->DescribeCode().length / sizeof(cell_t);
+		words_ = (cells_ + 31) / 32;
+		bits_ = std::make_unique<std::atomic<uint32_t>[]>(words_);
+		for (size_t i = 0; i < words_; i++)
+			bits_[i].store(0, std::memory_order_relaxed);
+		applied_.resize(words_);
+	}
+
+	bool test(cell_t cip) const {
+		size_t cell = (ucell_t)cip / sizeof(cell_t);
+		if (cell >= cells_)
+			return false;
+		return (bits_[cell / 32].load(std::memory_order_relaxed) >> (cell % 32)) & 1;
+	}
+
+	/* Replaces the armed set with the given (file name, line) pairs and step traps. */
+	void rebuild(const std::vector<const BreakList*>& lists, const TrapList& traps) {
+		if (!cells_)
+			return;
+		std::vector<uint32_t> bits(words_);
+		for (auto& trap : traps) {
+			if (trap.first != runtime_)
+				continue;
+			for (auto cip : *trap.second) {
+				size_t cell = (ucell_t)cip / sizeof(cell_t);
+				if (cell < cells_)
+					bits[cell / 32] |= 1u << (cell % 32);
+			}
+		}
+		for (uint32_t i = 0; i < image_->GetFileCount(); i++) {
+			const char* filename = image_->GetFileName(i);
+			if (!filename)
+				continue;
+			auto current_file = std::filesystem::path(filename).filename().string();
+			for (auto list : lists) {
+				auto found = list->find(current_file);
+				if (found == list->end())
+					continue;
+				for (auto line : found->second) {
+					uint32_t addr;
+					/* LookupLine reports line + 1, so ask for the line before */
+					if (line < 1 || !image_->GetLineAddress(line - 1, filename, &addr))
+						continue;
+					size_t cell = addr / sizeof(cell_t);
+					if (cell < cells_)
+						bits[cell / 32] |= 1u << (cell % 32);
+				}
+			}
+		}
+		for (size_t i = 0; i < words_; i++)
+			bits_[i].store(bits[i], std::memory_order_relaxed);
+		dirty_.store(true, std::memory_order_release);
+	}
+
+	/* Patches the BREAK sites that changed since the last call. Game thread only. */
+	void apply(ISourcePawnDebugHooks* hooks, bool all) {
+		if (dirty_.exchange(false, std::memory_order_acquire)) {
+			for (size_t i = 0; i < words_; i++) {
+				uint32_t bits = bits_[i].load(std::memory_order_relaxed);
+				uint32_t changed = bits ^ applied_[i];
+				for (uint32_t bit = 0; changed; bit++, changed >>= 1) {
+					if (changed & 1) {
+						ucell_t cip = (ucell_t)(i * 32 + bit) * sizeof(cell_t);
+						hooks->SetDebugBreakSite(runtime_, cip, (bits >> bit) & 1);
+					}
+				}
+				applied_[i] = bits;
+			}
+		}
+		if (all != applied_all_) {
+			hooks->SetAllDebugBreakSites(runtime_, all);
+			applied_all_ = all;
+		}
+	}
+
+	const std::shared_ptr<SmxV1Image>& image() const {
+		return image_;
+	}
+
+private:
+	IPluginRuntime* runtime_;
+	std::shared_ptr<SmxV1Image> image_;
+	size_t cells_ = 0;
+	size_t words_ = 0;
+	std::unique_ptr<std::atomic<uint32_t>[]> bits_;
+	std::atomic<bool> dirty_{ false };
+	std::vector<uint32_t> applied_;
+	bool applied_all_ = false;
+};
+
+std::mutex breakpoint_maps_mtx;
+std::unordered_map<IPluginRuntime*, std::unique_ptr<BreakpointMap>> breakpoint_maps;
+/* set when the runtime compiles BREAK opcodes as patchable sites */
+ISourcePawnDebugHooks* patch_env = nullptr;
+/* set when the runtime checks stores against data watch ranges */
+ISourcePawnDebugHooks* watch_env = nullptr;
+
+/* The break's data watch hit, if any. Only watching runtimes pass the extended info. */
+static const sp_debug_break_info_ex_t* WatchHit(const sp_debug_break_info_t& info) {
+	if (!watch_env)
+		return nullptr;
+	auto ex = static_cast<const sp_debug_break_info_ex_t*>(&info);
+	return ex->watch_size ? ex : nullptr;
+}
+
+// Keeps a few outbound buffers around so replies reuse storage that has
+// already grown to fit, instead of regrowing a fresh buffer every time.
+class MessagePool {
+public:
+	std::unique_ptr<CUtlBuffer> Acquire() {
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (free_.empty())
+			return std::make_unique<CUtlBuffer>(0, kInitialSize);
+		auto buffer = std::move(free_.back());
+		free_.pop_back();
+		return buffer;
+	}
+
+	// Called from the network thread once the transport is done with it.
+	void Release(std::unique_ptr<CUtlBuffer> buffer) {
+		if (buffer->Size() > kMaxRetainedSize)
+			return;
+		buffer->Clear();
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (free_.size() < kMaxBuffers)
+			free_.push_back(std::move(buffer));
+	}
+
+private:
+	static const int kInitialSize = 4096;
+	static const int kMaxRetainedSize = 4 * 1024 * 1024;
+	static const size_t kMaxBuffers = 8;
+
+	std::mutex mutex_;
+	std::vector<std::unique_ptr<CUtlBuffer>> free_;
+};
+
+// One outbound frame. The length prefix is reserved up front and patched
+// by Finish(); the message itself is queued on the connection, so the
+// payload is not copied again on its way out.
+class OutMessage : public SendableMsg {
+public:
+	OutMessage(std::shared_ptr<MessagePool> pool, MessageType type)
+		: pool_(std::move(pool)), buffer_(pool_->Acquire()) {
+		buffer_->PutUnsignedInt(0);
+		buffer_->PutChar(type);
+	}
+
+	~OutMessage() override {
+		pool_->Release(std::move(buffer_));
+	}
+
+	CUtlBuffer& buffer() {
+		return *buffer_;
+	}
+
+	// Replaces the payload with its compressed form if that is smaller.
+	void Compress() {
+		auto base = static_cast<const Bytef*>(buffer_->Base());
+		uLong raw_len = buffer_->TellPut() - kFrameHeaderSize;
+		uLongf packed_len = compressBound(raw_len);
+
+		auto packed = pool_->Acquire();
+		packed->EnsureCapacity(kFrameHeaderSize + sizeof(uint32_t) + packed_len);
+		packed->PutUnsignedInt(0);
+		packed->PutUnsignedChar(base[sizeof(uint32_t)] | kCompressedFlag);
+		packed->PutUnsignedInt(raw_len);
+		if (compress2(static_cast<Bytef*>(packed->PeekPut()), &packed_len,
+			base + kFrameHeaderSize, raw_len, Z_BEST_SPEED) != Z_OK ||
+			packed_len + sizeof(uint32_t) >= raw_len) {
+			pool_->Release(std::move(packed));
+			return;
+		}
+		packed->SeekPut(CUtlBuffer::SEEK_CURRENT, packed_len);
+		buffer_.swap(packed);
+		pool_->Release(std::move(packed));
+	}
+
+	void Finish() {
+		uint32_t len = buffer_->TellPut() - kFrameHeaderSize;
+		memcpy(buffer_->Base(), &len, sizeof(len));
+	}
+
+	const void* data() override {
+		return buffer_->Base();
+	}
+
+	size_t size() override {
+		return buffer_->TellPut();
+	}
+
+private:
+	std::shared_ptr<MessagePool> pool_;
+	std::unique_ptr<CUtlBuffer> buffer_;
+};
+
+// Unbounded single-producer/single-consumer queue. push() may only be
+// called from one thread and pop()/empty() from one other thread.
+template <typename T>
+class SpscQueue {
+	struct Node {
+		T value;
+		std::atomic<Node*> next{ nullptr };
+	};
+
+public:
+	SpscQueue() : head_(new Node), tail_(head_) {
+	}
+
+	~SpscQueue() {
+		while (head_) {
+			auto next = head_->next.load(std::memory_order_relaxed);
+			delete head_;
+			head_ = next;
+		}
+	}
+
+	SpscQueue(const SpscQueue&) = delete;
+	SpscQueue& operator=(const SpscQueue&) = delete;
+
+	void push(T value) {
+		auto node = new Node;
+		node->value = std::move(value);
+		tail_->next.store(node, std::memory_order_release);
+		tail_ = node;
+	}
+
+	bool pop(T& value) {
+		auto next = head_->next.load(std::memory_order_acquire);
+		if (!next)
+			return false;
+		value = std::move(next->value);
+		delete head_;
+		head_ = next;
+		return true;
+	}
+
+	bool empty() const {
+		return head_->next.load(std::memory_order_acquire) == nullptr;
+	}
+
+private:
+	Node* head_; // consumer side, always a consumed node
+	Node* tail_; // producer side
+};
+
 class DebuggerClient {
 public:
 	TcpConnection::Ptr socket;
@@ -119,6 +640,21 @@ public:
 		std::string name;
 		std::string value;
 		std::string type;
+		// Non-zero for arrays and structs, whose elements are fetched
+		// separately through RequestVariableSlice.
+		uint32_t handle = 0;
+		uint32_t children = 0;
+		// With CapBinaryValues, value holds raw bytes described by these.
+		uint8_t tag = ValueText;
+		uint8_t rtti_type = 0;
+		uint32_t rtti_index = 0;
+	};
+
+	// A live memory location with a type, handed to clients as a handle.
+	struct var_handle_s {
+		uint32_t addr;
+		const debug::Rtti* rtti;
+		bool is_ref;
 	};
 
 	struct call_stack_s {
@@ -127,6 +663,24 @@ public:
 		std::string filename;
 	};
 
+	// One frame of the stack a stop was taken on, innermost first. The
+	// frame iterator reports neither code address nor frame pointer, so
+	// only the top frame has its exact cip; further up, cip is the address
+	// of the reported line. frm is followed through the frame pointers the
+	// stopped plugin saved on entry to each of its functions and is 0 for
+	// frames of other plugins and on the exception path.
+	struct stack_frame_s {
+		SourcePawn::IPluginContext* ctx;
+		bool native;
+		cell_t function_cip;
+		cell_t cip;
+		cell_t frm;
+		uint32_t line;
+		int file_index;
+		const char* function;
+		std::string path;
+	};
+
 	struct breakpoint_s {
 		long line;
 		std::string filename;
@@ -134,25 +688,128 @@ public:
 
 public:
 	bool unload = false;
-	bool receive_walk_cmd = false;
+	// Also written by the network thread when the connection goes away.
+	std::atomic<bool> receive_walk_cmd{ false };
+	// Set while the game thread is parked in WaitWalkCmd.
+	bool waiting = false;
+	// Soft stop (DebuggerSoftStop): instead of parking the game thread, the
+	// stopped plugin is paused and the stop is served from what was
+	// captured when it happened. Game thread only.
+	bool frozen = false;
+	IPlugin* frozen_plugin = nullptr;
+	std::vector<call_stack_s> frozen_stack;
+	std::vector<variable_s> frozen_locals;
 	std::mutex mtx;
 	std::condition_variable cv;
+
+	// Commands are decoded on the network thread and run on the game thread,
+	// which is the only one allowed to touch the plugin while it may run.
+	// Replies travel back the same way and are sent from the event loop.
+	struct command_s {
+		int type;
+		std::vector<char> payload;
+	};
+	typedef SpscQueue<std::shared_ptr<OutMessage>> ReplyQueue;
+	SpscQueue<command_s> commands;
+	std::shared_ptr<ReplyQueue> replies = std::make_shared<ReplyQueue>();
+	bool replies_pending = false;
 	SourcePawn::IPluginContext* context_;
 	uint32_t current_line;
-	std::unordered_map<std::string, std::unordered_set<long>> break_list;
-	int current_state = 0;
+	BreakList break_list;
+	// Condition, hit count and log message of breakpoints that have any,
+	// by file and line.
+	struct break_options_s {
+		std::unique_ptr<Condition> condition;
+		std::unique_ptr<LogMessage> log;
+		uint32_t hit_target = 0;
+		uint32_t hits = 0;
+	};
+	std::map<std::pair<std::string, uint32_t>, break_options_s> breakpoint_options;
+	// Log point output of the current tick, sent as one Output message.
+	std::vector<std::string> pending_output;
+	uint32_t dropped_output = 0;
+	WatchpointList watchpoints;
+	// Where a step over or out may land: the lines of the function it
+	// returns to, reached at a frame no deeper than frm. Empty while no
+	// such step is under way or when its target is unknown, in which case
+	// every line is polled instead.
+	struct step_trap_s {
+		SourcePawn::IPluginContext* ctx = nullptr;
+		cell_t frm = 0;
+		std::vector<cell_t> cips;
+	};
+	step_trap_s step_trap;
+	std::atomic<int> current_state{ 0 };
 	cell_t lastfrm_ = 0;
 	cell_t cip_;
 	cell_t frm_;
-	std::map<std::string, std::shared_ptr<SmxV1Image>> images;
 	std::shared_ptr<SmxV1Image> current_image = nullptr;
 	SourcePawn::IFrameIterator* debug_iter;
+	// Stack of the current stop, walked on first use and kept until the
+	// plugin resumes.
+	std::vector<stack_frame_s> stack_frames;
+	bool stack_valid = false;
+	// Per-scope fingerprints of what this client was last sent, keyed by
+	// variable name, and the handles given out for aggregate values. Both
+	// are reset whenever the client resyncs or the image changes.
+	std::unordered_map<std::string, std::unordered_map<std::string, uint64_t>> var_hashes;
+	std::vector<var_handle_s> var_handles;
+	std::map<std::tuple<uint32_t, const debug::Rtti*, bool>, uint32_t> var_handle_ids;
+	std::shared_ptr<SmxV1Image> var_image;
+	std::shared_ptr<MessagePool> send_pool = std::make_shared<MessagePool>();
+	bool binary_values = false;
+	bool compress_replies = false;
+	bool frame_index = false;
+	bool variable_handles = false;
 	DebuggerClient(const TcpConnection::Ptr& tcp_connection)
 		: socket(tcp_connection) {
 	}
 
+	std::shared_ptr<OutMessage> BeginMessage(MessageType type) {
+		return std::make_shared<OutMessage>(send_pool, type);
+	}
+
+	// Game thread only. Queued until the next FlushReplies().
+	void Send(const std::shared_ptr<OutMessage>& msg) {
+		auto threshold = SM_Debugger_compress_threshold();
+		if (compress_replies && threshold &&
+			msg->size() - kFrameHeaderSize > threshold)
+			msg->Compress();
+		msg->Finish();
+		replies->push(msg);
+		replies_pending = true;
+	}
+
+	// Hands every queued reply to the connection's event loop in one go.
+	void FlushReplies() {
+		if (!replies_pending)
+			return;
+		replies_pending = false;
+		auto queue = replies;
+		auto connection = socket;
+		socket->getEventLoop()->runAsyncFunctor([queue, connection]() {
+			std::shared_ptr<OutMessage> msg;
+			while (queue->pop(msg))
+				connection->send(msg);
+		});
+	}
+
+	// Game thread only. Runs every command received so far.
+	void PumpCommands() {
+		command_s command;
+		while (commands.pop(command)) {
+			CUtlBuffer buf(command.payload.data(), command.payload.size());
+			DispatchCmd(command.type, &buf);
+		}
+		FlushReplies();
+	}
+
 	~DebuggerClient() {
 		stopDebugging();
+		if (frozen_plugin) {
+			std::lock_guard<std::mutex> lock(thaw_mtx);
+			thaw_plugins.push_back(frozen_plugin);
+		}
 		fmt::print("Debugger disabled.\n");
 	}
 
@@ -168,6 +825,7 @@ public:
 
 	void setBreakpoint(std::string path, int line, int id) {
 		break_list[path].insert(line);
+		RebuildBreakpointMaps();
 	}
 
 	void clearBreakpoints(std::string fileName) {
@@ -175,6 +833,69 @@ public:
 		if (found != break_list.end()) {
 			found->second.clear();
 		}
+		breakpoint_options.erase(breakpoint_options.lower_bound({ fileName, 0 }),
+			breakpoint_options.upper_bound({ fileName, UINT32_MAX }));
+		RebuildBreakpointMaps();
+	}
+
+	void sendDiagnostics(const std::string& text) {
+		auto msg = BeginMessage(MessageType::Diagnostics);
+		msg->buffer().PutInt(text.size() + 1);
+		msg->buffer().PutString(text.c_str());
+		Send(msg);
+	}
+
+	// Whether a breakpoint on the current line should stop. A condition
+	// that cannot be evaluated stops, so the user gets to see why. Hits
+	// are counted once the condition holds; log points never stop.
+	bool ShouldStopAtBreakpoint(const std::string& current_file) {
+		auto found = breakpoint_options.find({ current_file, current_line });
+		if (found == breakpoint_options.end())
+			return true;
+		auto& bp = found->second;
+		if (bp.condition) {
+			bool result;
+			std::string error;
+			if (!bp.condition->Evaluate(current_image, context_, cip_, frm_, &result, &error)) {
+				sendDiagnostics(fmt::format("{}:{}: condition '{}': {}", current_file,
+					current_line, bp.condition->source(), error));
+				return true;
+			}
+			if (!result)
+				return false;
+		}
+		if (bp.hits < UINT32_MAX)
+			bp.hits++;
+		if (bp.hits < bp.hit_target)
+			return false;
+		if (bp.log) {
+			if (pending_output.size() < kMaxOutputPerTick)
+				pending_output.push_back(bp.log->Format(current_image, context_, cip_, frm_));
+			else
+				dropped_output++;
+			return false;
+		}
+		return true;
+	}
+
+	// Game thread only. Sends the log point output gathered since the last
+	// call as one message.
+	void FlushOutput() {
+		if (pending_output.empty())
+			return;
+		if (dropped_output) {
+			pending_output.push_back(fmt::format("({} more log point messages dropped)", dropped_output));
+			dropped_output = 0;
+		}
+		auto msg = BeginMessage(MessageType::Output);
+		CUtlBuffer& buffer = msg->buffer();
+		buffer.PutInt(pending_output.size());
+		for (auto& line : pending_output) {
+			buffer.PutInt(line.size() + 1);
+			buffer.PutString(line.c_str());
+		}
+		Send(msg);
+		pending_output.clear();
 	}
 
 	enum {
@@ -369,10 +1090,6 @@ public:
 		{
 			auto fields = current_image->getEnumFields(rtti->index());
 
-			size_t start{};
-
-			start = addr;
-
 			for (auto& field : fields)
 			{
 				auto name = current_image->GetDebugName(field->name);
@@ -381,6 +1098,8 @@ public:
 				{
 					break;
 				}
+				/* fields are placed by their RTTI offset, as in slice_variable */
+				uint32_t start = addr + field->offset;
 				json[name] = read_variable(start, rtti_field->type(), (sp::debug::Rtti*)rtti_field);
 			}
 			break;
@@ -407,45 +1126,398 @@ public:
 
 		return json;
 	}
-	variable_s display_variable(SmxV1Image::Symbol* sym, uint32_t index[],
-		int idxlevel, bool noarray = false) {
-		nlohmann::json json;
-		variable_s var;
-		var.name = "N/A";
-		if (current_image->GetDebugName(sym->name()) != nullptr) {
-			var.name = current_image->GetDebugName(sym->name());
-		};
-		var.type = "N/A";
-		var.value = "";
-		cell_t value;
-		std::unique_ptr<std::vector<SmxV1Image::ArrayDim*>> symdims;
-		assert(index != NULL);
-		auto rtti = sym->rtti();
-		if (rtti && rtti->type_id)
-		{
-			size_t base = rtti->address;
-			if (sym->vclass() == 1 || sym->vclass() == 3) // local var or arg but not static
-				base += frm_; // addresses of local vars are relative to the frame
+	static void hash_bytes(uint64_t& hash, const void* data, size_t len) {
+		// FNV-1a
+		auto bytes = static_cast<const uint8_t*>(data);
+		for (size_t i = 0; i < len; i++) {
+			hash ^= bytes[i];
+			hash *= 1099511628211ULL;
+		}
+	}
 
-			try
+	// Walks the same memory read_variable would render, mixing it into hash
+	// instead of building a json value.
+	void hash_variable(uint32_t& addr, const debug::Rtti* rtti, bool is_ref,
+		uint64_t& hash)
+	{
+		if (!rtti)
+			return;
+		cell_t* ptr;
+		switch (rtti->type())
+		{
+		case cb::kAny:
+		case cb::kBool:
+		case cb::kInt32:
+		case cb::kFloat32:
+		{
+			if (context_->LocalToPhysAddr(addr, &ptr) == SP_ERROR_NONE)
+				hash_bytes(hash, ptr, sizeof(cell_t));
+			break;
+		}
+		case cb::kFixedArray:
+		{
+			if (rtti->inner())
 			{
-				auto json = read_variable(base, rtti->type_id, nullptr, sym->vclass() == 0x3);
-				if (!json.empty())
+				if (rtti->inner()->type() == cb::kChar8)
 				{
-					var.value = json.dump();
-					return var;
+					hash_variable(addr, rtti->inner(), false, hash);
+				}
+				else
+				{
+					for (int i = 0; i < rtti->index(); i++)
+					{
+						auto start = addr;
+						hash_variable(start, rtti->inner(), false, hash);
+						addr += 4;
+					}
 				}
 			}
-			catch(...)
+			break;
+		}
+		case cb::kChar8:
+		{
+			char* str = nullptr;
+			if (context_->LocalToStringNULL(addr, &str) != SP_ERROR_NONE || !str)
+				break;
+			size_t len = strlen(str);
+			hash_bytes(hash, str, len + 1);
+			addr += len + 1;
+			if (addr % sizeof(cell_t) != 0)
+				addr += sizeof(cell_t) - (addr % sizeof(cell_t));
+			break;
+		}
+		case cb::kArray:
+		{
+			if (is_ref)
 			{
-				// skip rtti parse
+				if (context_->LocalToPhysAddr(addr, &ptr) != SP_ERROR_NONE)
+					break;
+				addr = *ptr;
 			}
+			hash_variable(addr, rtti->inner(), false, hash);
+			break;
 		}
-		// first check whether the variable is visible at all
-		if ((uint32_t)cip_ < sym->codestart() ||
-			(uint32_t)cip_ > sym->codeend()) {
-			var.value = "Not in scope.";
-			return var;
+		case cb::kEnumStruct:
+		{
+			for (auto& field : current_image->getEnumFields(rtti->index()))
+			{
+				auto rtti_field = current_image->rtti_data()->typeFromTypeId(field->type_id);
+				if (!rtti_field)
+					break;
+				uint32_t start = addr + field->offset;
+				hash_variable(start, rtti_field, false, hash);
+			}
+			break;
+		}
+		case cb::kClassdef:
+		{
+			uint32_t field_offset = addr;
+			for (auto& field : current_image->getTypeFields(rtti->index()))
+			{
+				uint32_t start = field_offset;
+				auto rtti_field = current_image->rtti_data()->typeFromTypeId(field->type_id);
+				hash_variable(start, rtti_field, true, hash);
+				field_offset += sizeof(cell_t);
+			}
+			break;
+		}
+		}
+	}
+
+	// Number of elements an aggregate is split into, or 0 if it is rendered
+	// inline. Strings stay inline.
+	uint32_t child_count(const debug::Rtti* rtti) {
+		switch (rtti->type())
+		{
+		case cb::kFixedArray:
+			if (rtti->inner() && rtti->inner()->type() != cb::kChar8)
+				return rtti->index();
+			break;
+		case cb::kEnumStruct:
+			return current_image->getEnumFields(rtti->index()).size();
+		case cb::kClassdef:
+			return current_image->getTypeFields(rtti->index()).size();
+		}
+		return 0;
+	}
+
+	// Encodes the value at addr as raw bytes for CapBinaryValues clients.
+	// Returns false for values that have no binary form, which are then
+	// expanded or rendered as text.
+	bool encode_value(variable_s& var, uint32_t addr, const debug::Rtti* rtti,
+		bool is_ref) {
+		static const uint32_t kMaxInlineCells = 1024;
+		cell_t* ptr;
+		if (rtti->type() == cb::kArray) {
+			if (!rtti->inner())
+				return false;
+			if (is_ref) {
+				if (context_->LocalToPhysAddr(addr, &ptr) != SP_ERROR_NONE)
+					return false;
+				addr = *ptr;
+			}
+			rtti = rtti->inner();
+		}
+
+		var.rtti_type = rtti->type();
+		var.rtti_index = rtti->index();
+		switch (rtti->type())
+		{
+		case cb::kAny:
+		case cb::kInt32:
+		case cb::kBool:
+		case cb::kFloat32:
+		{
+			if (context_->LocalToPhysAddr(addr, &ptr) != SP_ERROR_NONE)
+				return false;
+			var.tag = rtti->type() == cb::kBool ? ValueBool :
+				rtti->type() == cb::kFloat32 ? ValueFloat : ValueCell;
+			var.value.assign(reinterpret_cast<const char*>(ptr), sizeof(cell_t));
+			return true;
+		}
+		case cb::kChar8:
+		{
+			char* str = nullptr;
+			if (context_->LocalToStringNULL(addr, &str) != SP_ERROR_NONE)
+				return false;
+			var.tag = ValueString;
+			var.value = str ? str : "";
+			return true;
+		}
+		case cb::kFixedArray:
+		{
+			auto inner = rtti->inner();
+			if (!inner)
+				return false;
+			if (inner->type() == cb::kChar8)
+				return encode_value(var, addr, inner, false);
+			if (inner->type() != cb::kAny && inner->type() != cb::kInt32 &&
+				inner->type() != cb::kBool && inner->type() != cb::kFloat32)
+				return false;
+			if (rtti->index() == 0 || rtti->index() > kMaxInlineCells)
+				return false;
+			// Make sure the whole array is addressable before copying it.
+			cell_t* last;
+			if (context_->LocalToPhysAddr(addr, &ptr) != SP_ERROR_NONE ||
+				context_->LocalToPhysAddr(addr + (rtti->index() - 1) * sizeof(cell_t),
+					&last) != SP_ERROR_NONE)
+				return false;
+			var.tag = ValueCells;
+			var.rtti_type = inner->type();
+			var.rtti_index = rtti->index();
+			var.value.assign(reinterpret_cast<const char*>(ptr),
+				rtti->index() * sizeof(cell_t));
+			return true;
+		}
+		}
+		return false;
+	}
+
+	// Turns var into a handle to the aggregate at addr instead of rendering
+	// it. Returns false for values that should be rendered inline.
+	bool expand_variable(variable_s& var, uint32_t addr,
+		const debug::Rtti* rtti, bool is_ref) {
+		if (!variable_handles)
+			return false;
+		if (rtti->type() == cb::kArray) {
+			cell_t* ptr;
+			if (!rtti->inner())
+				return false;
+			if (is_ref) {
+				if (context_->LocalToPhysAddr(addr, &ptr) != SP_ERROR_NONE)
+					return false;
+				addr = *ptr;
+			}
+			rtti = rtti->inner();
+			is_ref = false;
+		}
+		auto children = child_count(rtti);
+		if (!children)
+			return false;
+
+		auto key = std::make_tuple(addr, rtti, is_ref);
+		auto it = var_handle_ids.find(key);
+		if (it == var_handle_ids.end()) {
+			var_handles.push_back({ addr, rtti, is_ref });
+			it = var_handle_ids.emplace(key, var_handles.size()).first;
+		}
+		var.handle = it->second;
+		var.children = children;
+		if (rtti->type() == cb::kFixedArray) {
+			var.type = "array";
+			var.value = "[" + std::to_string(children) + "]";
+		}
+		else {
+			var.type = rtti->type() == cb::kEnumStruct ? "enum struct" : "object";
+			var.value = "{...}";
+		}
+		return true;
+	}
+
+	variable_s make_child(std::string name, uint32_t addr,
+		const debug::Rtti* rtti, bool is_ref) {
+		variable_s var{ std::move(name), "", "N/A" };
+		if (!rtti)
+			return var;
+		if (binary_values && encode_value(var, addr, rtti, is_ref))
+			return var;
+		if (expand_variable(var, addr, rtti, is_ref))
+			return var;
+		try
+		{
+			auto json = read_variable(addr, rtti->type(), const_cast<debug::Rtti*>(rtti), is_ref);
+			var.value = json.dump();
+		}
+		catch (...)
+		{
+			var.value = "(?)";
+		}
+		return var;
+	}
+
+	// Renders elements [start, start + count) of the aggregate behind handle.
+	std::vector<variable_s> slice_variable(const var_handle_s& node,
+		uint32_t start, uint32_t count) {
+		std::vector<variable_s> vars;
+		auto total = child_count(node.rtti);
+		if (start >= total)
+			return vars;
+		count = std::min(count, total - start);
+		switch (node.rtti->type())
+		{
+		case cb::kFixedArray:
+		{
+			auto inner = node.rtti->inner();
+			// Sub-arrays are reached through an indirection vector holding
+			// the offset of each sub-array relative to its own cell.
+			bool indirect = inner->type() == cb::kFixedArray ||
+				inner->type() == cb::kEnumStruct;
+			for (uint32_t i = start; i < start + count; i++) {
+				uint32_t addr = node.addr + i * sizeof(cell_t);
+				if (indirect) {
+					cell_t* ptr;
+					if (context_->LocalToPhysAddr(addr, &ptr) != SP_ERROR_NONE)
+						break;
+					addr += *ptr;
+				}
+				vars.push_back(make_child(std::to_string(i), addr, inner, false));
+			}
+			break;
+		}
+		case cb::kEnumStruct:
+		{
+			auto fields = current_image->getEnumFields(node.rtti->index());
+			for (uint32_t i = start; i < start + count; i++) {
+				auto field = fields[i];
+				auto name = current_image->GetDebugName(field->name);
+				vars.push_back(make_child(name ? name : "N/A",
+					node.addr + field->offset,
+					current_image->rtti_data()->typeFromTypeId(field->type_id),
+					false));
+			}
+			break;
+		}
+		case cb::kClassdef:
+		{
+			auto fields = current_image->getTypeFields(node.rtti->index());
+			for (uint32_t i = start; i < start + count; i++) {
+				auto field = fields[i];
+				auto name = current_image->GetDebugName(field->name);
+				vars.push_back(make_child(name ? name : "N/A",
+					node.addr + i * sizeof(cell_t),
+					current_image->rtti_data()->typeFromTypeId(field->type_id),
+					true));
+			}
+			break;
+		}
+		}
+		return vars;
+	}
+
+	// Cheap fingerprint of a variable's current value. Identical memory
+	// yields the same fingerprint, so unchanged variables need not be
+	// rendered or sent again.
+	// Fingerprint of a captured value, e.g. a soft stop's frozen locals.
+	static uint64_t fingerprint(const variable_s& var) {
+		uint64_t hash = 14695981039346656037ULL;
+		hash_bytes(hash, &var.tag, sizeof(var.tag));
+		hash_bytes(hash, var.value.data(), var.value.size());
+		hash_bytes(hash, var.type.data(), var.type.size());
+		return hash;
+	}
+
+	uint64_t fingerprint(SmxV1Image::Symbol* sym) {
+		uint64_t hash = 14695981039346656037ULL;
+		auto rtti = sym->rtti();
+		if (rtti && rtti->type_id)
+		{
+			uint32_t base = rtti->address;
+			if (sym->vclass() == 1 || sym->vclass() == 3) // local var or arg but not static
+				base += frm_;
+			hash_bytes(hash, &base, sizeof(base));
+			try
+			{
+				hash_variable(base, current_image->rtti_data()->typeFromTypeId(rtti->type_id),
+					sym->vclass() == 0x3, hash);
+				return hash;
+			}
+			catch (...)
+			{
+				// fall back to the rendered value
+			}
+		}
+		uint32_t idx[MAX_DIMS], dim = 0;
+		memset(idx, 0, sizeof idx);
+		auto var = display_variable(sym, idx, dim);
+		hash_bytes(hash, var.value.data(), var.value.size());
+		return hash;
+	}
+
+	variable_s display_variable(SmxV1Image::Symbol* sym, uint32_t index[],
+		int idxlevel, bool noarray = false) {
+		nlohmann::json json;
+		variable_s var;
+		var.name = "N/A";
+		if (current_image->GetDebugName(sym->name()) != nullptr) {
+			var.name = current_image->GetDebugName(sym->name());
+		};
+		var.type = "N/A";
+		var.value = "";
+		cell_t value;
+		std::unique_ptr<std::vector<SmxV1Image::ArrayDim*>> symdims;
+		assert(index != NULL);
+		auto rtti = sym->rtti();
+		if (rtti && rtti->type_id)
+		{
+			size_t base = rtti->address;
+			if (sym->vclass() == 1 || sym->vclass() == 3) // local var or arg but not static
+				base += frm_; // addresses of local vars are relative to the frame
+
+			try
+			{
+				auto type = current_image->rtti_data()->typeFromTypeId(rtti->type_id);
+				if (type && binary_values &&
+					encode_value(var, base, type, sym->vclass() == 0x3))
+					return var;
+				if (type && expand_variable(var, base, type, sym->vclass() == 0x3))
+					return var;
+				auto json = read_variable(base, rtti->type_id, nullptr, sym->vclass() == 0x3);
+				if (!json.empty())
+				{
+					var.value = json.dump();
+					return var;
+				}
+			}
+			catch(...)
+			{
+				// skip rtti parse
+			}
+		}
+		// first check whether the variable is visible at all
+		if ((uint32_t)cip_ < sym->codestart() ||
+			(uint32_t)cip_ > sym->codeend()) {
+			var.value = "Not in scope.";
+			return var;
 		}
 
 		// set default display type for the symbol (if none was set)
@@ -592,33 +1664,27 @@ public:
 	}
 
 	void evaluateVar(int frame_id, char* variable) {
-		if (current_state != DebugRun) {
-			auto imagev1 = current_image.get();
-
-			std::unique_ptr<SmxV1Image::Symbol> sym;
-			if (imagev1->GetVariable(variable, cip_, sym)) {
+		if (current_state == DebugRun)
+			return;
+		withFrame(frame_index ? frame_id : 0, false, [&] {
+			auto sym = current_image->FindVariable(variable, cip_);
+			if (sym && (sym->vclass() & DISP_MASK) && !frm_)
+				sym = nullptr; // its frame could not be located
+			if (sym) {
 				uint32_t idx[MAX_DIMS], dim;
 				dim = 0;
 				memset(idx, 0, sizeof idx);
-				auto var = display_variable(sym.get(), idx, dim);
-				CUtlBuffer buffer;
-				buffer.PutUnsignedInt(0);
+				variable_s var;
+				if (!frozenLocal(sym, var))
+					var = display_variable(sym, idx, dim);
+				auto msg = BeginMessage(MessageType::Evaluate);
 				{
-					buffer.PutChar(MessageType::Evaluate);
-					buffer.PutInt(var.name.size() + 1);
-					buffer.PutString(var.name.c_str());
-					buffer.PutInt(var.value.size() + 1);
-					buffer.PutString(var.value.c_str());
-					;
-					buffer.PutInt(var.type.size() + 1);
-					buffer.PutString(var.type.c_str());
-					buffer.PutInt(0);
+					CUtlBuffer& buffer = msg->buffer();
+					putVariable(buffer, var);
 				}
-				*(uint32_t*)buffer.Base() = buffer.TellPut() - 5;
-				socket->send(static_cast<const char*>(buffer.Base()),
-					static_cast<size_t>(buffer.TellPut()));
+				Send(msg);
 			}
-		}
+		});
 	}
 
 	int set_symbolvalue(const SmxV1Image::Symbol* sym, int index,
@@ -671,16 +1737,18 @@ public:
 		bool valid_value = true;
 		if (current_state != DebugRun) {
 			auto imagev1 = current_image.get();
-			std::unique_ptr<SmxV1Image::Symbol> sym;
+			auto sym = imagev1->FindVariable(var.c_str(), cip_);
+			if (sym && frozen && (sym->vclass() & DISP_MASK))
+				sym = nullptr; // its frame is gone
 			cell_t result = 0;
 			value.erase(remove(value.begin(), value.end(), '\"'), value.end());
-			if (imagev1->GetVariable(var.c_str(), cip_, sym)) {
+			if (sym) {
 
 				if ((sym->ident() == IDENT_ARRAY ||
 					sym->ident() == IDENT_REFARRAY)) {
 					if ((sym->vclass() & ~DISP_MASK) == DISP_STRING) {
 
-						SetSymbolString(sym.get(), const_cast<char*>(value.c_str()));
+						SetSymbolString(sym, const_cast<char*>(value.c_str()));
 					}
 					valid_value = false;
 				}
@@ -710,21 +1778,149 @@ public:
 					}
 				}
 
-				if (valid_value &&
-					(imagev1->GetVariable(var.c_str(), cip_, sym))) {
-					success = set_symbolvalue(sym.get(), index, (cell_t)result);
+				if (valid_value) {
+					success = set_symbolvalue(sym, index, (cell_t)result);
 				}
 			}
 		}
-		CUtlBuffer buffer;
-		buffer.PutUnsignedInt(0);
+		auto msg = BeginMessage(MessageType::SetVariable);
 		{
-			buffer.PutChar(MessageType::SetVariable);
+			CUtlBuffer& buffer = msg->buffer();
 			buffer.PutInt(success);
 		}
-		*(uint32_t*)buffer.Base() = buffer.TellPut() - 5;
-		socket->send(static_cast<const char*>(buffer.Base()),
-			static_cast<size_t>(buffer.TellPut()));
+		Send(msg);
+	}
+
+	// The frame of a frozen stop is gone; its locals only exist in the copy
+	// taken when it stopped. Returns false for anything that is still live.
+	bool frozenLocal(SmxV1Image::Symbol* sym, variable_s& var) {
+		if (!frozen || !(sym->vclass() & DISP_MASK))
+			return false;
+		auto name = current_image->GetDebugName(sym->name());
+		for (auto& local : frozen_locals) {
+			if (name && local.name == name) {
+				var = local;
+				return true;
+			}
+		}
+		var = { name ? name : "N/A", "(?)", "" };
+		return true;
+	}
+
+	// Runs func with cip_ and frm_ pointing at frame `index` of the stop,
+	// 0 being the frame it stopped in. Only frames of the stopped plugin
+	// can be inspected; need_frm also rejects those whose locals could not
+	// be located.
+	template <typename Func>
+	bool withFrame(int index, bool need_frm, Func&& func) {
+		if (index <= 0) {
+			func();
+			return true;
+		}
+		if (frozen)
+			return false;
+		auto frame = Frame(index);
+		if (!frame || frame->native || frame->ctx != context_ || !frame->cip ||
+			(need_frm && !frame->frm))
+			return false;
+
+		cell_t cip = cip_, frm = frm_;
+		cip_ = frame->cip;
+		frm_ = frame->frm;
+		func();
+		cip_ = cip;
+		frm_ = frm;
+		return true;
+	}
+
+	// Scopes may name a frame of the stop, e.g. "2:%local%" or "2:name";
+	// without a frame index, or for clients that did not ask for
+	// CapFrameIndex, they refer to the top frame.
+	int scopeFrame(const char* scope, const char** name) const {
+		if (!frame_index) {
+			*name = scope;
+			return 0;
+		}
+		char* end;
+		unsigned long index = strtoul(scope, &end, 10);
+		if (end == scope || *end != ':') {
+			*name = scope;
+			return 0;
+		}
+		*name = end + 1;
+		return (int)index;
+	}
+
+	template <typename Func>
+	void forEachLocal(Func&& func) {
+		// Only variables in scope.
+		current_image->ForEachLocalSymbol(cip_, [&](SmxV1Image::Symbol* sym) {
+			if (sym->ident() != sp::IDENT_FUNCTION &&
+				(sym->vclass() & DISP_MASK) > 0) {
+				func(sym);
+			}
+		});
+	}
+
+	template <typename Func>
+	void forEachGlobal(Func&& func) {
+		current_image->ForEachGlobalSymbol([&](SmxV1Image::Symbol* sym) {
+			if (!((sym->vclass() & DISP_MASK) > 0)) {
+				func(sym);
+			}
+		});
+	}
+
+	void collectLocals(std::vector<variable_s>& vars) {
+		if (frozen) {
+			vars.insert(vars.end(), frozen_locals.begin(), frozen_locals.end());
+			return;
+		}
+		uint32_t idx[MAX_DIMS], dim = 0;
+		memset(idx, 0, sizeof idx);
+		forEachLocal([&](SmxV1Image::Symbol* sym) {
+			vars.push_back(display_variable(sym, idx, dim));
+		});
+	}
+
+	void collectGlobals(std::vector<variable_s>& vars) {
+		uint32_t idx[MAX_DIMS], dim = 0;
+		memset(idx, 0, sizeof idx);
+		forEachGlobal([&](SmxV1Image::Symbol* sym) {
+			vars.push_back(display_variable(sym, idx, dim));
+		});
+	}
+
+	void putVariable(CUtlBuffer& buffer, const variable_s& var) {
+		buffer.PutInt(var.name.size() + 1);
+		buffer.PutString(var.name.c_str());
+		if (binary_values) {
+			buffer.PutUnsignedChar(var.tag);
+			buffer.PutUnsignedChar(var.rtti_type);
+			buffer.PutUnsignedInt(var.rtti_index);
+			buffer.PutUnsignedInt(var.value.size());
+			buffer.Put(var.value.data(), var.value.size());
+		}
+		else {
+			buffer.PutInt(var.value.size() + 1);
+			buffer.PutString(var.value.c_str());
+		}
+		buffer.PutInt(var.type.size() + 1);
+		buffer.PutString(var.type.c_str());
+		if (variable_handles) {
+			buffer.PutInt(var.handle);
+			buffer.PutInt(var.children);
+		}
+		else {
+			buffer.PutInt(0);
+		}
+	}
+
+	void putVariables(CUtlBuffer& buffer,
+		const std::vector<variable_s>& vars) {
+		buffer.PutInt(vars.size());
+		for (auto& var : vars)
+			putVariable(buffer, var);
 	}
 
 	void sendVariables(char* scope) {
@@ -733,190 +1929,447 @@ public:
 		if (current_state != DebugRun) {
 			auto imagev1 = current_image.get();
 
-			std::unique_ptr<SmxV1Image::Symbol> sym;
 			if (current_image && imagev1) {
 #define sDIMEN_MAX 4
 				uint32_t idx[sDIMEN_MAX], dim;
 				dim = 0;
 				memset(idx, 0, sizeof idx);
 				std::vector<variable_s> vars;
-				if (local_scope || global_scope) {
-					SmxV1Image::SymbolIterator iter = imagev1->symboliterator(global_scope);
-					while (!iter.Done()) {
-						const auto sym = iter.Next();
-
-						// Only variables in scope.
-						if (sym->ident() != sp::IDENT_FUNCTION &&
-							(sym->codestart() <= (uint32_t)cip_ &&
-								sym->codeend() >= (uint32_t)cip_) || global_scope) {
-							auto var = display_variable(sym, idx, dim);
-							if (local_scope) {
-								if ((sym->vclass() & DISP_MASK) > 0) {
-									vars.push_back(var);
-								}
-							}
-							else {
-								if (!((sym->vclass() & DISP_MASK) > 0)) {
-									vars.push_back(var);
-								}
-							}
-						}
-					}
+				const char* name;
+				int frame = scopeFrame(scope, &name);
+				if (local_scope) {
+					withFrame(frame, true, [&] { collectLocals(vars); });
+				}
+				else if (global_scope) {
+					collectGlobals(vars);
 				}
 				else {
-					if (imagev1->GetVariable(scope, cip_, sym)) {
-						auto var = display_variable(sym.get(), idx, dim, true);
-						std::string var_name = scope;
-						auto values = split_string(var.value, ",");
-						int i = 0;
-						for (auto val : values) {
-							vars.push_back({ std::to_string(i), val, var.type });
-							i++;
+					withFrame(frame, false, [&] {
+						auto sym = imagev1->FindVariable(name, cip_);
+						if (sym && (sym->vclass() & DISP_MASK) && !frm_)
+							sym = nullptr; // its frame could not be located
+						if (sym) {
+							variable_s var;
+							if (!frozenLocal(sym, var))
+								var = display_variable(sym, idx, dim, true);
+							/* only the plain text rendering of an array splits into elements */
+							if (var.handle || binary_values) {
+								vars.push_back(std::move(var));
+								return;
+							}
+							auto values = split_string(var.value, ",");
+							int i = 0;
+							for (auto val : values) {
+								vars.push_back({ std::to_string(i), val, var.type });
+								i++;
+							}
 						}
-					}
+					});
 				}
-				CUtlBuffer buffer;
-				buffer.PutUnsignedInt(0);
-				buffer.PutChar(Variables);
+				auto msg = BeginMessage(MessageType::Variables);
+				CUtlBuffer& buffer = msg->buffer();
 				buffer.PutInt(strlen(scope) + 1);
 				buffer.PutString(scope);
-				buffer.PutInt(vars.size());
-				for (auto var : vars) {
-					buffer.PutInt(var.name.size() + 1);
-					buffer.PutString(var.name.c_str());
-					buffer.PutInt(var.value.size() + 1);
-					buffer.PutString(var.value.c_str());
-					;
-					buffer.PutInt(var.type.size() + 1);
-					buffer.PutString(var.type.c_str());
-					buffer.PutInt(0);
-				}
-				*(uint32_t*)buffer.Base() = buffer.TellPut() - 5;
-				socket->send(static_cast<const char*>(buffer.Base()),
-					static_cast<size_t>(buffer.TellPut()));
+				putVariables(buffer, vars);
+				Send(msg);
 			}
 		}
 	}
 
-	void CallStack() {
-		std::vector<call_stack_s> callStack;
-		if (current_state == DebugException) {
-			if (debug_iter) {
-				uint32_t index = 0;
-				for (; !debug_iter->Done(); debug_iter->Next(), index++) {
-
-					if (debug_iter->IsNativeFrame()) {
-						callStack.push_back({ 0,
-											 debug_iter->FunctionName(),
-											 "native" });
-					}
-					else if (debug_iter->IsScriptedFrame()) {
-						auto current_file = std::filesystem::path(debug_iter->FilePath()).filename().string();
-						lowercase(current_file);
-						callStack.push_back({ debug_iter->LineNumber() - 1,
-											 debug_iter->FunctionName(),
-											 current_file });
-					}
-				}
+	// Like sendVariables for the local or global scope, but only sends the
+	// variables whose fingerprint changed since the last delta this client
+	// received for that scope, followed by the names that went away.
+	void sendVariablesDelta(char* scope) {
+		bool local_scope = strstr(scope, ":%local%");
+		bool global_scope = strstr(scope, ":%global%");
+		if (current_state == DebugRun || !current_image ||
+			(!local_scope && !global_scope))
+			return;
+
+		const char* name;
+		int frame = local_scope ? scopeFrame(scope, &name) : 0;
+		std::string key = local_scope ? ":%local%" : ":%global%";
+		if (frame > 0)
+			key = std::to_string(frame) + key;
+		auto& previous = var_hashes[key];
+		std::unordered_map<std::string, uint64_t> current;
+		std::vector<variable_s> changed;
+		uint32_t idx[MAX_DIMS], dim = 0;
+		memset(idx, 0, sizeof idx);
+		auto visit = [&](SmxV1Image::Symbol* sym) {
+			auto name = current_image->GetDebugName(sym->name());
+			if (!name)
+				return;
+			auto hash = fingerprint(sym);
+			current[name] = hash;
+			auto it = previous.find(name);
+			if (it == previous.end() || it->second != hash)
+				changed.push_back(display_variable(sym, idx, dim));
+		};
+		if (local_scope && frozen && frame <= 0) {
+			for (auto& local : frozen_locals) {
+				auto hash = fingerprint(local);
+				current[local.name] = hash;
+				auto it = previous.find(local.name);
+				if (it == previous.end() || it->second != hash)
+					changed.push_back(local);
 			}
-			current_state = DebugBreakpoint;
 		}
-		else if (current_state != DebugRun) {
-
-			IFrameIterator* iter = context_->CreateFrameIterator();
-
-			uint32_t index = 0;
-			for (; !iter->Done(); iter->Next(), index++) {
-
-				if (iter->IsNativeFrame()) {
-					callStack.push_back({ 0,
-										 iter->FunctionName(),
-										 "" });
-				}
-				else if (iter->IsScriptedFrame()) {
-					std::string current_file = iter->FilePath();
-					for (auto file : files) {
-						if (file.find(current_file) != std::string::npos) {
-							current_file = file;
-							break;
-						}
-					}
-					callStack.push_back({ iter->LineNumber() - 1,
-										 iter->FunctionName(), current_file });
-				}
-			}
-			context_->DestroyFrameIterator(iter);
+		else if (local_scope)
+			withFrame(frame, true, [&] { forEachLocal(visit); });
+		else
+			forEachGlobal(visit);
+
+		std::vector<std::string> removed;
+		for (auto& entry : previous) {
+			if (current.find(entry.first) == current.end())
+				removed.push_back(entry.first);
 		}
+		previous.swap(current);
 
-		CUtlBuffer buffer;
-		buffer.PutUnsignedInt(0);
+		auto msg = BeginMessage(MessageType::VariablesDelta);
 		{
-			buffer.PutChar(MessageType::CallStack);
-			buffer.PutInt(callStack.size());
-			for (auto stack : callStack) {
-				buffer.PutInt(stack.name.size() + 1);
-				buffer.PutString(stack.name.c_str());
-				buffer.PutInt(stack.filename.size() + 1);
-				buffer.PutString(stack.filename.c_str());
-				buffer.PutInt(stack.line + 1);
+			CUtlBuffer& buffer = msg->buffer();
+			buffer.PutInt(strlen(scope) + 1);
+			buffer.PutString(scope);
+			putVariables(buffer, changed);
+			buffer.PutInt(removed.size());
+			for (auto& name : removed) {
+				buffer.PutInt(name.size() + 1);
+				buffer.PutString(name.c_str());
 			}
 		}
-		*(uint32_t*)buffer.Base() = buffer.TellPut() - 5;
-		socket->send(static_cast<const char*>(buffer.Base()),
-			static_cast<size_t>(buffer.TellPut()));
+		Send(msg);
 	}
 
-	void WaitWalkCmd(std::string reason = "Breakpoint",
-		std::string text = "N/A") {
-		if (!receive_walk_cmd) {
-			CUtlBuffer buffer;
-			{
-				buffer.PutUnsignedInt(0);
-				{
-					buffer.PutChar(MessageType::HasStopped);
-					buffer.PutInt(reason.size() + 1);
-					buffer.PutString(reason.c_str());
-					buffer.PutInt(reason.size() + 1);
-					buffer.PutString(reason.c_str());
-					buffer.PutInt(text.size() + 1);
-					buffer.PutString(text.c_str());
-				}
-				*(uint32_t*)buffer.Base() = buffer.TellPut() - 5;
-			}
-			socket->send(static_cast<const char*>(buffer.Base()),
-				static_cast<size_t>(buffer.TellPut()));
-			std::unique_lock<std::mutex> lck(mtx);
-			cv.wait(lck, [this] { return receive_walk_cmd; });
+	void sendVariableSlice(uint32_t handle, uint32_t start, uint32_t count) {
+		std::vector<variable_s> vars;
+		uint32_t total = 0;
+		if (current_state != DebugRun && current_image &&
+			handle > 0 && handle <= var_handles.size()) {
+			auto node = var_handles[handle - 1];
+			total = child_count(node.rtti);
+			vars = slice_variable(node, start, count);
 		}
-		if(current_state == DebugDead)
+
+		auto msg = BeginMessage(MessageType::VariableSlice);
 		{
-			unload = true;
-			throw debugger_stopped();
+			CUtlBuffer& buffer = msg->buffer();
+			buffer.PutInt(handle);
+			buffer.PutInt(total);
+			buffer.PutInt(start);
+			putVariables(buffer, vars);
 		}
+		Send(msg);
 	}
 
-	void ReportError(const IErrorReport& report, IFrameIterator& iter) {
-		receive_walk_cmd = false;
-		current_state = DebugException;
-		context_ = iter.Context();
-		debug_iter = &iter;
-		WaitWalkCmd("exception", report.Message());
+	// Index of a file in the image's file table, -1 if it has none.
+	static int fileIndex(SmxV1Image* image, const char* path) {
+		if (!path)
+			return -1;
+		for (uint32_t i = 0; i < image->GetFileCount(); i++) {
+			const char* name = image->GetFileName(i);
+			if (name && strcmp(name, path) == 0)
+				return i;
+		}
+		return -1;
 	}
-	int(DebugHook)(SourcePawn::IPluginContext* ctx,
-		sp_debug_break_info_t& BreakInfo) {
-		std::string filename = ctx->GetRuntime()->GetFilename();
-		auto image = images.find(filename);
-		if (image == images.end()) {
-			FILE* fp = fopen(filename.c_str(), "rb");
-			current_image = std::make_shared<SmxV1Image>(fp);
-			current_image->validate();
-			images.insert({ filename, current_image });
-			fclose(fp);
+
+	void walkFrames(IFrameIterator& iter, bool exact_top) {
+		cell_t frm = exact_top ? frm_ : 0;
+		for (; !iter.Done(); iter.Next()) {
+			stack_frame_s frame = {};
+			frame.ctx = iter.Context();
+			frame.function = iter.FunctionName();
+			frame.file_index = -1;
+			if (iter.IsNativeFrame()) {
+				frame.native = true;
+				stack_frames.push_back(frame);
+				continue;
+			}
+			if (!iter.IsScriptedFrame())
+				continue;
+
+			const char* path = iter.FilePath();
+			frame.path = path ? path : "";
+			frame.line = iter.LineNumber() - 1;
+			auto image = image_cache.Find(frame.ctx->GetRuntime());
+			if (image && path) {
+				uint32_t addr;
+				if (frame.function &&
+					image->GetFunctionAddress(frame.function, path, &addr))
+					frame.function_cip = addr;
+				if (exact_top && frame.ctx == context_)
+					frame.cip = cip_;
+				else if (image->GetLineAddress(frame.line, path, &addr))
+					frame.cip = addr;
+				frame.file_index = fileIndex(image.get(), path);
+			}
+			if (frame.ctx == context_ && frm) {
+				/* PROC saves the caller's frm right above the old heap pointer */
+				cell_t* saved;
+				frame.frm = frm;
+				if (context_->LocalToPhysAddr(frm + sizeof(cell_t), &saved) == SP_ERROR_NONE)
+					frm = *saved;
+				else
+					frm = 0;
+			}
+			exact_top = false;
+			stack_frames.push_back(frame);
 		}
-		else {
-			current_image = image->second;
+	}
+
+	// The stack of the current stop. The exception path can walk the
+	// reported iterator only once, so the result is kept until resume.
+	const std::vector<stack_frame_s>& Frames() {
+		if (stack_valid || current_state == DebugRun)
+			return stack_frames;
+		stack_frames.clear();
+		if (current_state == DebugException) {
+			if (debug_iter)
+				walkFrames(*debug_iter, false);
+			debug_iter = nullptr;
 		}
-		context_ = ctx;
+		else {
+			IFrameIterator* iter = context_->CreateFrameIterator();
+			walkFrames(*iter, true);
+			context_->DestroyFrameIterator(iter);
+		}
+		stack_valid = true;
+		return stack_frames;
+	}
+
+	const stack_frame_s* Frame(size_t index) {
+		auto& frames = Frames();
+		return index < frames.size() ? &frames[index] : nullptr;
+	}
+
+	void DropFrames() {
+		stack_frames.clear();
+		stack_valid = false;
+	}
+
+	std::vector<call_stack_s> collectCallStack() {
+		if (frozen)
+			return frozen_stack;
+		std::vector<call_stack_s> callStack;
+		if (current_state == DebugRun)
+			return callStack;
+		bool exception = current_state == DebugException;
+		for (auto& frame : Frames()) {
+			std::string name = frame.function ? frame.function : "";
+			if (frame.native) {
+				callStack.push_back({ 0, name, exception ? "native" : "" });
+			}
+			else if (exception) {
+				auto current_file = std::filesystem::path(frame.path).filename().string();
+				lowercase(current_file);
+				callStack.push_back({ frame.line, name, current_file });
+			}
+			else {
+				std::string current_file = frame.path;
+				for (auto file : files) {
+					if (file.find(current_file) != std::string::npos) {
+						current_file = file;
+						break;
+					}
+				}
+				callStack.push_back({ frame.line, name, current_file });
+			}
+		}
+		if (exception)
+			current_state = DebugBreakpoint;
+		return callStack;
+	}
+
+	static void putCallStack(CUtlBuffer& buffer,
+		const std::vector<call_stack_s>& callStack) {
+		buffer.PutInt(callStack.size());
+		for (auto& stack : callStack) {
+			buffer.PutInt(stack.name.size() + 1);
+			buffer.PutString(stack.name.c_str());
+			buffer.PutInt(stack.filename.size() + 1);
+			buffer.PutString(stack.filename.c_str());
+			buffer.PutInt(stack.line + 1);
+		}
+	}
+
+	void CallStack() {
+		auto callStack = collectCallStack();
+		auto msg = BeginMessage(MessageType::CallStack);
+		{
+			CUtlBuffer& buffer = msg->buffer();
+			putCallStack(buffer, callStack);
+		}
+		Send(msg);
+	}
+
+	// Answers a stop with everything a client usually asks for next: the
+	// call stack, the locals and globals of the top frame and the given
+	// watch expressions, all gathered in one pass and sent as one frame.
+	void sendSnapshot(const std::vector<std::string>& watches) {
+		if (current_state == DebugRun || !current_image)
+			return;
+
+		std::vector<variable_s> locals, globals, watched;
+		auto callStack = collectCallStack();
+		collectLocals(locals);
+		collectGlobals(globals);
+		for (auto& watch : watches) {
+			uint32_t idx[MAX_DIMS], dim = 0;
+			memset(idx, 0, sizeof idx);
+			auto sym = current_image->FindVariable(watch.c_str(), cip_);
+			variable_s var;
+			if (sym && frozenLocal(sym, var)) {
+				watched.push_back(var);
+			}
+			else if (sym) {
+				watched.push_back(display_variable(sym, idx, dim));
+			}
+			else {
+				watched.push_back({ watch, "(?)", "" });
+			}
+		}
+
+		auto msg = BeginMessage(MessageType::Snapshot);
+		{
+			CUtlBuffer& buffer = msg->buffer();
+			putCallStack(buffer, callStack);
+			putVariables(buffer, locals);
+			putVariables(buffer, globals);
+			putVariables(buffer, watched);
+		}
+		Send(msg);
+	}
+
+	void resetVariableState() {
+		var_hashes.clear();
+		var_handles.clear();
+		var_handle_ids.clear();
+		var_image = current_image;
+	}
+
+	void WaitWalkCmd(std::string reason = "Breakpoint",
+		std::string text = "N/A") {
+		if (var_image != current_image)
+			resetVariableState();
+		FlushOutput();
+		disarmStep();
+		if (!receive_walk_cmd) {
+			bool soft_stop = SM_Debugger_soft_stop();
+			/* a different stop kind, so clients don't present the snapshot as live */
+			std::string kind = soft_stop ? "paused" : reason;
+			auto msg = BeginMessage(MessageType::HasStopped);
+			{
+				CUtlBuffer& buffer = msg->buffer();
+				buffer.PutInt(kind.size() + 1);
+				buffer.PutString(kind.c_str());
+				buffer.PutInt(reason.size() + 1);
+				buffer.PutString(reason.c_str());
+				buffer.PutInt(text.size() + 1);
+				buffer.PutString(text.c_str());
+			}
+			Send(msg);
+			FlushReplies();
+			if (soft_stop) {
+				Freeze();
+				return;
+			}
+			{
+				std::lock_guard<std::mutex> lck(mtx);
+				waiting = true;
+			}
+			for (;;) {
+				{
+					std::unique_lock<std::mutex> lck(mtx);
+					cv.wait(lck, [this] {
+						return receive_walk_cmd || !commands.empty();
+					});
+					if (receive_walk_cmd && commands.empty())
+						break;
+				}
+				PumpCommands();
+			}
+			{
+				std::lock_guard<std::mutex> lck(mtx);
+				waiting = false;
+			}
+			cv.notify_all();
+			DropFrames();
+		}
+		if(current_state == DebugDead)
+		{
+			{
+				std::lock_guard<std::mutex> lck(mtx);
+				unload = true;
+			}
+			cv.notify_all();
+			throw debugger_stopped();
+		}
+	}
+
+	// Captures what the client can still ask about once the frame is gone
+	// and pauses the plugin, so its forwards are skipped until the client
+	// resumes. The call in progress runs to completion.
+	void Freeze() {
+		frozen_stack = collectCallStack();
+		frozen_locals.clear();
+		collectLocals(frozen_locals);
+		DropFrames();
+		frozen = true;
+		frozen_plugin = plsys->FindPluginByContext(context_->GetContext());
+	}
+
+	// Game thread only, outside of plugin code.
+	void Thaw(bool resume = true) {
+		frozen = false;
+		frozen_stack.clear();
+		frozen_locals.clear();
+		if (resume && frozen_plugin &&
+			frozen_plugin->GetStatus() == Plugin_Paused)
+			frozen_plugin->SetPauseState(false);
+		if (frozen_plugin)
+			ResetContextState(frozen_plugin->GetBaseContext());
+		frozen_plugin = nullptr;
+	}
+
+	// Game frame: the plugin is no longer running, so it can be paused now.
+	void OnGameFrame() {
+		if (frozen && frozen_plugin &&
+			frozen_plugin->GetStatus() == Plugin_Running)
+			frozen_plugin->SetPauseState(true);
+		FlushOutput();
+		PumpCommands();
+	}
+
+	void ReportError(const IErrorReport& report, IFrameIterator& iter) {
+		if (frozen)
+			return;
+		receive_walk_cmd = false;
+		current_state = DebugException;
+		context_ = iter.Context();
+		current_image = image_cache.Find(context_->GetRuntime());
+		debug_iter = &iter;
+		DropFrames();
+		WaitWalkCmd("exception", report.Message());
+	}
+	bool AtBreakpoint(const std::string& current_file) {
+		auto found = break_list.find(current_file);
+		return found != break_list.end() &&
+			found->second.find(current_line) != found->second.end() &&
+			ShouldStopAtBreakpoint(current_file);
+	}
+
+	// repeat: the break is on the same line as the plugin's previous one.
+	int(DebugHook)(SourcePawn::IPluginContext* ctx,
+		sp_debug_break_info_t& BreakInfo, bool repeat) {
+		/* one stop at a time; the frozen call just runs to completion */
+		if (frozen)
+			return current_state;
+		current_image = image_cache.Find(ctx->GetRuntime());
+		context_ = ctx;
+		if (!current_image)
+			return current_state;
 		if (current_state == DebugDead)
 			return current_state;
 
@@ -925,61 +2378,68 @@ public:
 		// Reset the state.
 		frm_ = BreakInfo.frm;
 		receive_walk_cmd = false;
+		DropFrames();
 
-		IFrameIterator* iter = context_->CreateFrameIterator();
-		std::string current_file = "N/A";
-		uint32_t index = 0;
-		for (; !iter->Done(); iter->Next(), index++) {
-
-			if (iter->IsNativeFrame()) {
-				continue;
-			}
+		/* a store hit the plugin's watched range; it may be another client's */
+		if (auto hit = WatchHit(BreakInfo)) {
+			std::string text;
+			if (!watchpoints.Match(ctx, hit->watch_addr, hit->watch_size, &text))
+				return current_state;
+			current_image->LookupLine(cip_, &current_line);
+			current_state = DebugBreakpoint;
+			WaitWalkCmd("data breakpoint", text);
+			lastfrm_ = frm_;
+			return current_state;
+		}
 
-			if (iter->IsScriptedFrame()) {
-				current_file = std::filesystem::path(iter->FilePath()).filename().string();
-				lowercase(current_file);
+		/* the break is in the top frame, no need to walk the stack */
+		std::string current_file = "N/A";
+		if (const char* path = current_image->LookupFile(cip_)) {
+			current_file = std::filesystem::path(path).filename().string();
+			lowercase(current_file);
 
-				for (auto file : files) {
-					if (file.find(current_file) != std::string::npos) {
-						current_file = file;
-						break;
-					}
+			for (auto file : files) {
+				if (file.find(current_file) != std::string::npos) {
+					current_file = file;
+					break;
 				}
-				break;
 			}
 		}
-		context_->DestroyFrameIterator(iter);
 
-		static uint32_t lastline = 0;
 		current_image->LookupLine(cip_, &current_line);
 		// Reset the frame iterator, so stack traces start at the beginning
 		// again.
 
 		/* dont break twice */
-		if (current_line == lastline)
+		if (repeat)
 			return current_state;
 
-		lastline = current_line;
+		/* a trapped step only hears from its landing sites and breakpoints */
+		if (!step_trap.cips.empty()) {
+			if (stepTrapHit(ctx)) {
+				WaitWalkCmd();
+			}
+			else if (AtBreakpoint(current_file)) {
+				current_state = DebugBreakpoint;
+				WaitWalkCmd();
+			}
+			lastfrm_ = frm_;
+			return current_state;
+		}
+
 		if (current_state == DebugStepOut && frm_ > lastfrm_)
 			current_state = DebugStepIn;
 
 		if (current_state == DebugPause || current_state == DebugStepIn) {
 			WaitWalkCmd();
 		}
-		else {
-
-			auto found = break_list.find(current_file);
-			if (found != break_list.end()) {
-				if (found->second.find(current_line) != found->second.end())
-				{
-					current_state = DebugBreakpoint;
-					WaitWalkCmd();
-				}
-			}
+		else if (AtBreakpoint(current_file)) {
+			current_state = DebugBreakpoint;
+			WaitWalkCmd();
 		}
 
 		/* check whether we are stepping through a sub-function */
-		if (current_state == DebugStepOver) {
+		if (current_state == DebugStepOver && step_trap.cips.empty()) {
 			if (frm_ < lastfrm_)
 			{
 				return current_state;
@@ -996,7 +2456,83 @@ public:
 		return current_state;
 	}
 
+	bool IsStepping() const {
+		if (frozen)
+			return false;
+		if (current_state == DebugStepOver || current_state == DebugStepOut)
+			return step_trap.cips.empty();
+		return current_state == DebugPause || current_state == DebugStepIn;
+	}
+
+	// Appends every BREAK address of the function a frame is in.
+	bool functionLines(const stack_frame_s& frame, std::vector<cell_t>& cips) {
+		/* without function symbols only the frame's own cip places it */
+		cell_t inside = frame.function_cip ? frame.function_cip : frame.cip;
+		std::vector<uint32_t> addrs;
+		if (!inside || !current_image->GetFunctionLineAddresses(inside, &addrs))
+			return false;
+		cips.insert(cips.end(), addrs.begin(), addrs.end());
+		return true;
+	}
+
+	// Arms the trap for a step over or out from the current stop. Step over
+	// lands in the current function or, once it returns, in its caller;
+	// step out only in the caller. A function the game called has no caller
+	// to aim at, and the next line may be in any callback, so those steps
+	// fall back to polling every line. Game thread only, while stopped.
+	void armStep(int state) {
+		step_trap_s trap;
+		auto top = waiting && current_image ? Frame(0) : nullptr;
+		if (!top || top->native || top->ctx != context_ || !top->frm)
+			return;
+		/* the next frame of this plugin, possibly beyond natives that called back */
+		const stack_frame_s* caller = nullptr;
+		for (auto& frame : Frames()) {
+			if (&frame != top && !frame.native && frame.ctx == context_) {
+				caller = &frame;
+				break;
+			}
+		}
+		/* returns into the game, nothing to aim at */
+		if (!caller || !caller->frm)
+			return;
+		if (state == DebugStepOver) {
+			if (!functionLines(*top, trap.cips))
+				return;
+			trap.frm = top->frm;
+		}
+		else {
+			trap.frm = caller->frm;
+		}
+		if (!functionLines(*caller, trap.cips))
+			return;
+
+		std::sort(trap.cips.begin(), trap.cips.end());
+		trap.cips.erase(std::unique(trap.cips.begin(), trap.cips.end()),
+			trap.cips.end());
+		trap.ctx = context_;
+		step_trap = std::move(trap);
+		RebuildBreakpointMaps();
+	}
+
+	void disarmStep() {
+		if (step_trap.cips.empty())
+			return;
+		step_trap = step_trap_s();
+		RebuildBreakpointMaps();
+	}
+
+	bool stepTrapHit(SourcePawn::IPluginContext* ctx) const {
+		return ctx == step_trap.ctx && frm_ >= step_trap.frm &&
+			std::binary_search(step_trap.cips.begin(), step_trap.cips.end(), cip_);
+	}
+
 	void SwitchState(unsigned char state) {
+		if (frozen)
+			Thaw();
+		disarmStep();
+		if (state == DebugStepOver || state == DebugStepOut)
+			armStep(state);
 		current_state = state;
 		receive_walk_cmd = true;
 		cv.notify_one();
@@ -1011,7 +2547,8 @@ public:
 		buf->GetString(file, strlen);
 		auto filename = std::filesystem::path(file).filename().string();
 		lowercase(filename);
-		files.insert(filename);
+		if (files.insert(filename).second)
+			InvalidateSubscriptions();
 	}
 
 	void RecvStateSwitch(CUtlBuffer* buf) {
@@ -1030,6 +2567,39 @@ public:
 		sendVariables(scope);
 	}
 
+	void recvRequestVariablesDelta(CUtlBuffer* buf) {
+		char scope[256];
+		int strlen = buf->GetInt();
+		buf->GetString(scope, strlen);
+		sendVariablesDelta(scope);
+	}
+
+	void recvRequestVariableSlice(CUtlBuffer* buf) {
+		auto handle = buf->GetUnsignedInt();
+		auto start = buf->GetUnsignedInt();
+		auto count = buf->GetUnsignedInt();
+		sendVariableSlice(handle, start, count);
+	}
+
+	void recvRequestCapabilities(CUtlBuffer* buf) {
+		uint32_t offered = kServerCapabilities;
+		if (watch_env)
+			offered |= CapDataBreakpoints;
+		uint32_t granted = buf->GetUnsignedInt() & offered;
+		binary_values = (granted & CapBinaryValues) != 0;
+		compress_replies = (granted & CapCompression) != 0;
+		frame_index = (granted & CapFrameIndex) != 0;
+		variable_handles = (granted & CapVariableHandles) != 0;
+
+		auto msg = BeginMessage(MessageType::Capabilities);
+		msg->buffer().PutUnsignedInt(granted);
+		Send(msg);
+	}
+
+	void recvResyncVariables(CUtlBuffer* buf) {
+		resetVariableState();
+	}
+
 	void recvRequestEvaluate(CUtlBuffer* buf) {
 		int frameId;
 		char variable[256];
@@ -1039,6 +2609,18 @@ public:
 		evaluateVar(frameId, variable);
 	}
 
+	void recvRequestSnapshot(CUtlBuffer* buf) {
+		std::vector<std::string> watches;
+		int count = buf->GetInt();
+		for (int i = 0; i < count && buf->IsValid(); i++) {
+			char watch[256];
+			int strlen = buf->GetInt();
+			buf->GetString(watch, strlen);
+			watches.push_back(watch);
+		}
+		sendSnapshot(watches);
+	}
+
 	void recvDisconnect(CUtlBuffer* buf) {
 	}
 
@@ -1048,12 +2630,79 @@ public:
 		buf->GetString(path, strlen);
 		std::string filename(std::filesystem::path(path).filename().string());
 		lowercase(filename);
-		files.insert(filename);
+		if (files.insert(filename).second)
+			InvalidateSubscriptions();
 		int line = buf->GetInt();
 		int id = buf->GetInt();
+		// Optional trailing condition, hit count and log message, in that
+		// order; older clients send none of them.
+		break_options_s bp;
+		std::string error;
+		std::string source = getOptionalString(buf);
+		if (!source.empty()) {
+			bp.condition = Condition::Parse(source, &error);
+			if (!bp.condition)
+				sendDiagnostics(fmt::format("{}:{}: condition '{}': {}",
+					filename, line, source, error));
+		}
+		if (buf->TellGet() + (int)sizeof(uint32_t) <= buf->Size())
+			bp.hit_target = buf->GetUnsignedInt();
+		source = getOptionalString(buf);
+		if (!source.empty()) {
+			bp.log = LogMessage::Parse(source, &error);
+			if (!bp.log)
+				sendDiagnostics(fmt::format("{}:{}: log message '{}': {}",
+					filename, line, source, error));
+		}
+		if (bp.condition || bp.log || bp.hit_target)
+			breakpoint_options[{ filename, line }] = std::move(bp);
+		else
+			breakpoint_options.erase({ filename, line });
 		setBreakpoint(filename, line, id);
 	}
 
+	// Reads a length-prefixed string if the message has one left.
+	std::string getOptionalString(CUtlBuffer* buf) {
+		if (buf->TellGet() >= buf->Size())
+			return std::string();
+		int length = buf->GetInt();
+		if (length < 1 || length > buf->Size() - buf->TellGet())
+			return std::string();
+		std::string str(length, '\0');
+		buf->GetString(&str[0], length);
+		return std::string(str.c_str());
+	}
+
+	void recvSetDataBreakpoint(CUtlBuffer* buf) {
+		char path[256];
+		int strlen = buf->GetInt();
+		buf->GetString(path, strlen);
+		std::string filename(std::filesystem::path(path).filename().string());
+		lowercase(filename);
+		std::string expression = getOptionalString(buf);
+		int id = buf->GetInt();
+
+		if (!watch_env) {
+			sendDiagnostics("data breakpoints need a SourcePawn runtime that supports them");
+			return;
+		}
+		std::shared_ptr<SmxV1Image> image;
+		auto runtime = FindRuntimeByFile(filename, &image);
+		std::string error;
+		if (!runtime)
+			error = "no loaded plugin contains " + filename;
+		else
+			watchpoints.Add(id, runtime->GetDefaultContext(), image, expression, &error);
+		if (!error.empty())
+			sendDiagnostics(fmt::format("data breakpoint '{}': {}", expression, error));
+		ApplyDataWatchRanges();
+	}
+
+	void recvClearDataBreakpoints(CUtlBuffer* buf) {
+		watchpoints.Clear();
+		ApplyDataWatchRanges();
+	}
+
 	void recvClearBreakpoints(CUtlBuffer* buf) {
 		char path[256];
 		int strlen = buf->GetInt();
@@ -1064,17 +2713,21 @@ public:
 		clearBreakpoints(filename);
 	}
 
+	// Releases a game thread parked in WaitWalkCmd and waits until it has
+	// left. Called from the network thread.
 	void stopDebugging() {
+		std::unique_lock<std::mutex> lck(mtx);
 		current_state = DebugDead;
 		receive_walk_cmd = true;
-		cv.notify_one();
-		std::unique_lock<std::mutex> lck(mtx);
-		cv.wait(lck, [this] { return unload; });
+		cv.notify_all();
+		cv.wait(lck, [this] { return unload || !waiting; });
 	}
 
 	void recvStopDebugging(CUtlBuffer* buf) {
-		stopDebugging();
-		removeClientID(socket);
+		current_state = DebugDead;
+		receive_walk_cmd = true;
+		// The disconnect callback removes this client.
+		socket->postDisConnect();
 	}
 
 	void recvRequestSetVariable(CUtlBuffer* buf) {
@@ -1088,89 +2741,485 @@ public:
 		setVariable(var, value, index);
 	}
 
-	void RecvCmd(const char* buffer, size_t len) {
-		CUtlBuffer buf((void*)buffer, len);
-		while (buf.TellGet() < len) {
-			int msg_len = buf.GetUnsignedInt();
-			int type = buf.GetUnsignedChar();
-			switch (type) {
-			case RequestFile: {
-				RecvDebugFile(&buf);
-				break;
-			}
-			case Pause: {
-				RecvStateSwitch(&buf);
-				break;
+	// Decodes every complete frame at the start of buffer and returns the
+	// number of bytes consumed. A trailing partial frame is left in place
+	// so the caller can hand it back once the rest has arrived.
+	size_t RecvCmd(const char* buffer, size_t len) {
+		size_t consumed = 0;
+		bool received = false;
+		while (len - consumed >= kFrameHeaderSize) {
+			const char* frame = buffer + consumed;
+			uint32_t msg_len;
+			memcpy(&msg_len, frame, sizeof(msg_len));
+			if (msg_len > kMaxRecvBufferSize - kFrameHeaderSize) {
+				// Can never be reassembled; the stream is out of sync.
+				socket->postDisConnect();
+				return len;
 			}
-			case Continue: {
-				RecvStateSwitch(&buf);
-				break;
-			}
-			case StepIn: {
-				RecvStateSwitch(&buf);
-				break;
-			}
-			case StepOver: {
-				RecvStateSwitch(&buf);
-				break;
-			}
-			case StepOut: {
-				RecvStateSwitch(&buf);
-				break;
-			}
-			case RequestCallStack: {
-				RecvCallStack(&buf);
-				break;
-			}
-			case RequestVariables: {
-				recvRequestVariables(&buf);
-				break;
-			}
-			case RequestEvaluate: {
-				recvRequestEvaluate(&buf);
-				break;
-			}
-			case Disconnect: {
-				recvDisconnect(&buf);
-				break;
-			}
-			case ClearBreakpoints: {
-				recvClearBreakpoints(&buf);
+			if (len - consumed < kFrameHeaderSize + msg_len)
 				break;
+
+			int type = static_cast<uint8_t>(frame[sizeof(msg_len)]);
+			const char* payload = frame + kFrameHeaderSize;
+			command_s command{ type & ~kCompressedFlag };
+			if (!(type & kCompressedFlag))
+				command.payload.assign(payload, payload + msg_len);
+			if (!(type & kCompressedFlag) ||
+				Inflate(payload, msg_len, command.payload)) {
+				commands.push(std::move(command));
+				received = true;
 			}
-			case SetBreakpoint: {
-				recvBreakpoint(&buf);
-				break;
+			consumed += kFrameHeaderSize + msg_len;
+		}
+		if (received) {
+			// Wake the game thread if it is parked in WaitWalkCmd; otherwise
+			// the commands run on the next game frame.
+			{
+				std::lock_guard<std::mutex> lck(mtx);
 			}
-			case StopDebugging: {
-				recvStopDebugging(&buf);
+			cv.notify_all();
+		}
+		return consumed;
+	}
+
+	static bool Inflate(const char* payload, size_t len,
+		std::vector<char>& out) {
+		uint32_t raw_len;
+		if (len < sizeof(raw_len))
+			return false;
+		memcpy(&raw_len, payload, sizeof(raw_len));
+		if (raw_len > kMaxInflatedSize)
+			return false;
+		out.resize(raw_len);
+		uLongf out_len = raw_len;
+		return uncompress(reinterpret_cast<Bytef*>(out.data()), &out_len,
+			reinterpret_cast<const Bytef*>(payload + sizeof(raw_len)),
+			len - sizeof(raw_len)) == Z_OK && out_len == raw_len;
+	}
+
+	void DispatchCmd(int type, CUtlBuffer* buf) {
+		switch (type) {
+		case RequestFile: {
+			RecvDebugFile(buf);
+			break;
+		}
+		case Pause: {
+			RecvStateSwitch(buf);
+			break;
+		}
+		case Continue: {
+			RecvStateSwitch(buf);
+			break;
+		}
+		case StepIn: {
+			RecvStateSwitch(buf);
+			break;
+		}
+		case StepOver: {
+			RecvStateSwitch(buf);
+			break;
+		}
+		case StepOut: {
+			RecvStateSwitch(buf);
+			break;
+		}
+		case RequestCallStack: {
+			RecvCallStack(buf);
+			break;
+		}
+		case RequestVariables: {
+			recvRequestVariables(buf);
+			break;
+		}
+		case RequestEvaluate: {
+			recvRequestEvaluate(buf);
+			break;
+		}
+		case Disconnect: {
+			recvDisconnect(buf);
+			break;
+		}
+		case ClearBreakpoints: {
+			recvClearBreakpoints(buf);
+			break;
+		}
+		case SetBreakpoint: {
+			recvBreakpoint(buf);
+			break;
+		}
+		case StopDebugging: {
+			recvStopDebugging(buf);
+			break;
+		}
+		case RequestSetVariable: {
+			recvRequestSetVariable(buf);
+			break;
+		}
+		case RequestSnapshot: {
+			recvRequestSnapshot(buf);
+			break;
+		}
+		case RequestVariablesDelta: {
+			recvRequestVariablesDelta(buf);
+			break;
+		}
+		case ResyncVariables: {
+			recvResyncVariables(buf);
+			break;
+		}
+		case RequestVariableSlice: {
+			recvRequestVariableSlice(buf);
+			break;
+		}
+		case RequestCapabilities: {
+			recvRequestCapabilities(buf);
+			break;
+		}
+		case SetDataBreakpoint: {
+			recvSetDataBreakpoint(buf);
+			break;
+		}
+		case ClearDataBreakpoints: {
+			recvClearDataBreakpoints(buf);
+			break;
+		}
+		}
+	}
+};
+
+//
+//  Connected clients, published as immutable snapshots. The game thread
+//  reads the current snapshot without locking; writers copy it under
+//  registry_mtx and swap the pointer. Replaced snapshots are freed on the
+//  next game frame, when no break can still be using them.
+//
+struct ClientRegistry {
+	std::vector<std::shared_ptr<DebuggerClient>> clients;
+	/* clients debugging each context, filled in by its first break */
+	std::unordered_map<IPluginContext*, std::vector<DebuggerClient*>> subscribers;
+};
+
+static std::atomic<const ClientRegistry*> registry{ new ClientRegistry };
+static std::mutex registry_mtx;
+static std::vector<const ClientRegistry*> retired_registries;
+/* set off the game thread when the maps need the current break lists */
+static std::atomic<bool> breakpoints_dirty{ false };
+/* set off the game thread when the VM watch ranges need recomputing */
+static std::atomic<bool> watchpoints_dirty{ false };
+
+/* Game thread, or with registry_mtx held. */
+const ClientRegistry& Clients() {
+	return *registry.load(std::memory_order_acquire);
+}
+
+/* registry_mtx must be held. */
+void PublishClients(const ClientRegistry* next) {
+	retired_registries.push_back(
+		registry.exchange(next, std::memory_order_acq_rel));
+}
+
+/* Game frame only: frees replaced snapshots and the clients they held last. */
+void ReclaimClients() {
+	std::vector<const ClientRegistry*> retired;
+	{
+		std::lock_guard<std::mutex> lock(registry_mtx);
+		retired.swap(retired_registries);
+	}
+	for (auto snapshot : retired) {
+		delete snapshot;
+	}
+}
+
+/* Clients that want breaks from ctx. Game thread only. */
+const std::vector<DebuggerClient*>& SubscribersOf(IPluginContext* ctx) {
+	auto& current = Clients();
+	auto found = current.subscribers.find(ctx);
+	if (found != current.subscribers.end())
+		return found->second;
+
+	std::lock_guard<std::mutex> lock(registry_mtx);
+	auto next = new ClientRegistry(Clients());
+	auto& subscribers = next->subscribers[ctx];
+	auto debug_info = ctx->GetRuntime()->GetDebugInfo();
+	for (auto& client : next->clients) {
+		for (uint32_t i = 0; i < debug_info->NumFiles(); i++) {
+			auto current_file = std::filesystem::path(debug_info->GetFileName(i)).filename().string();
+			lowercase(current_file);
+			if (client->files.find(current_file) != client->files.end()) {
+				subscribers.push_back(client.get());
 				break;
 			}
-			case RequestSetVariable: {
-				recvRequestSetVariable(&buf);
+		}
+	}
+	PublishClients(next);
+	return subscribers;
+}
+
+/* A client's files changed. Game thread only. */
+void InvalidateSubscriptions() {
+	std::lock_guard<std::mutex> lock(registry_mtx);
+	auto next = new ClientRegistry{ Clients().clients, {} };
+	PublishClients(next);
+}
+
+void ForgetContext(IPluginContext* ctx) {
+	std::lock_guard<std::mutex> lock(registry_mtx);
+	if (!Clients().subscribers.count(ctx))
+		return;
+	auto next = new ClientRegistry(Clients());
+	next->subscribers.erase(ctx);
+	PublishClients(next);
+}
+
+std::shared_ptr<DebuggerClient> addClientID(const TcpConnection::Ptr& session) {
+	auto client = std::make_shared<DebuggerClient>(session);
+	client->AskFile();
+	std::lock_guard<std::mutex> lock(registry_mtx);
+	auto next = new ClientRegistry{ Clients().clients, {} };
+	next->clients.push_back(client);
+	PublishClients(next);
+	return client;
+}
+
+void removeClientID(const TcpConnection::Ptr& session) {
+	std::shared_ptr<DebuggerClient> client;
+	{
+		std::lock_guard<std::mutex> lock(registry_mtx);
+		for (auto& candidate : Clients().clients) {
+			if (candidate->socket == session) {
+				client = candidate;
 				break;
 			}
+		}
+	}
+	if (!client)
+		return;
+
+	/* release the game thread first, it may need the registry to get out */
+	client->stopDebugging();
+
+	std::lock_guard<std::mutex> lock(registry_mtx);
+	auto next = new ClientRegistry{ {}, {} };
+	for (auto& candidate : Clients().clients) {
+		if (candidate != client)
+			next->clients.push_back(candidate);
+	}
+	PublishClients(next);
+	breakpoints_dirty = true;
+	watchpoints_dirty = true;
+}
+
+static void CollectBreakpoints(std::vector<const BreakList*>& lists,
+	TrapList& traps) {
+	for (auto& client : Clients().clients) {
+		lists.push_back(&client->break_list);
+		if (!client->step_trap.cips.empty())
+			traps.emplace_back(client->step_trap.ctx->GetRuntime(),
+				&client->step_trap.cips);
+	}
+}
+
+/* Game thread only. */
+void RebuildBreakpointMaps() {
+	breakpoints_dirty = false;
+	std::vector<const BreakList*> lists;
+	TrapList traps;
+	CollectBreakpoints(lists, traps);
+	std::lock_guard<std::mutex> lock(breakpoint_maps_mtx);
+	for (auto& map : breakpoint_maps) {
+		map.second->rebuild(lists, traps);
+	}
+}
+
+/* most breaks come from the plugin that hit the previous one */
+static IPluginRuntime* last_runtime = nullptr;
+static BreakpointMap* last_map = nullptr;
+
+BreakpointMap* FindBreakpointMap(IPluginRuntime* runtime) {
+	if (runtime == last_runtime)
+		return last_map;
+
+	/* may wait for the image, so resolve it before taking the lock */
+	auto image = image_cache.Find(runtime);
+	std::lock_guard<std::mutex> lock(breakpoint_maps_mtx);
+	auto& map = breakpoint_maps[runtime];
+	if (!map) {
+		map = std::make_unique<BreakpointMap>(runtime, image);
+		std::vector<const BreakList*> lists;
+		TrapList traps;
+		CollectBreakpoints(lists, traps);
+		map->rebuild(lists, traps);
+	}
+	last_runtime = runtime;
+	last_map = map.get();
+	return last_map;
+}
+
+/* The plugin built from the given source file. Game thread only. */
+IPluginRuntime* FindRuntimeByFile(const std::string& filename,
+	std::shared_ptr<SmxV1Image>* image) {
+	std::lock_guard<std::mutex> lock(breakpoint_maps_mtx);
+	for (auto& map : breakpoint_maps) {
+		auto& candidate = map.second->image();
+		if (!candidate)
+			continue;
+		for (uint32_t i = 0; i < candidate->GetFileCount(); i++) {
+			const char* name = candidate->GetFileName(i);
+			if (!name)
+				continue;
+			auto current_file = std::filesystem::path(name).filename().string();
+			lowercase(current_file);
+			if (current_file == filename) {
+				*image = candidate;
+				return map.first;
 			}
 		}
 	}
-};
+	return nullptr;
+}
+
+/* contexts whose VM watch range is armed */
+static std::unordered_set<IPluginContext*> watched_contexts;
 
-std::vector<std::unique_ptr<DebuggerClient>> clients;
+/* Arms each plugin's watch range with the union of every client's
+ * watchpoints there. Game thread only. */
+void ApplyDataWatchRanges() {
+	watchpoints_dirty = false;
+	if (!watch_env)
+		return;
 
-void addClientID(const TcpConnection::Ptr& session) {
-	clients.push_back(std::make_unique<DebuggerClient>(session));
-	clients.back()->AskFile();
+	WatchpointList::RangeMap ranges;
+	for (auto& client : Clients().clients) {
+		client->watchpoints.Collect(ranges);
+	}
+	for (auto ctx : watched_contexts) {
+		if (!ranges.count(ctx))
+			watch_env->SetDataWatchRange(ctx->GetRuntime(), 0, 0);
+	}
+	watched_contexts.clear();
+	for (auto& range : ranges) {
+		watch_env->SetDataWatchRange(range.first->GetRuntime(), range.second.first,
+			range.second.second - range.second.first);
+		watched_contexts.insert(range.first);
+	}
 }
 
-void removeClientID(const TcpConnection::Ptr& session) {
-	for (auto it = clients.begin(); it != clients.end(); ++it) {
-		if ((*it)->socket == session) {
-			clients.erase(it);
+/* Called by the image cache, possibly off the game thread. */
+void OnImageReady(IPluginRuntime* runtime, uint64_t serial,
+	const std::shared_ptr<SmxV1Image>& image) {
+	std::lock_guard<std::mutex> lock(breakpoint_maps_mtx);
+	if (!image_cache.IsCurrent(runtime, serial))
+		return;
+	auto& map = breakpoint_maps[runtime];
+	if (map)
+		return;
+	/* break lists belong to the game thread, which fills the map in */
+	map = std::make_unique<BreakpointMap>(runtime, image);
+	breakpoints_dirty = true;
+}
+
+/* Mirrors the breakpoint maps into the JIT. Game thread only. */
+void ApplyBreakpointPatches() {
+	if (!patch_env)
+		return;
+
+	/* stepping needs every line of every plugin */
+	bool stepping = false;
+	for (auto& client : Clients().clients) {
+		if (client->IsStepping()) {
+			stepping = true;
 			break;
 		}
 	}
+	std::lock_guard<std::mutex> lock(breakpoint_maps_mtx);
+	for (auto& map : breakpoint_maps) {
+		map.second->apply(patch_env, stepping);
+	}
 }
 
+void OnBreakpointsGameFrame(bool simulating) {
+	{
+		std::lock_guard<std::mutex> lock(thaw_mtx);
+		for (auto plugin : thaw_plugins) {
+			if (plugin->GetStatus() == Plugin_Paused)
+				plugin->SetPauseState(false);
+		}
+		thaw_plugins.clear();
+	}
+	ReclaimClients();
+	if (breakpoints_dirty)
+		RebuildBreakpointMaps();
+	if (watchpoints_dirty)
+		ApplyDataWatchRanges();
+	/* commands that arrived while no plugin was stopped */
+	for (auto& client : Clients().clients) {
+		client->OnGameFrame();
+	}
+	ApplyBreakpointPatches();
+}
+
+class BreakpointPluginsListener : public IPluginsListener {
+public:
+	void OnPluginLoaded(IPlugin* plugin) override {
+		auto runtime = plugin->GetRuntime();
+		if (!runtime)
+			return;
+		/* prepare image and map now: unarmed sites would never reach DebugHandler */
+		image_cache.Add(runtime);
+		ApplyBreakpointPatches();
+	}
+
+	void OnPluginUnloaded(IPlugin* plugin) override {
+		{
+			std::lock_guard<std::mutex> lock(thaw_mtx);
+			thaw_plugins.erase(std::remove(thaw_plugins.begin(),
+				thaw_plugins.end(), plugin), thaw_plugins.end());
+		}
+		for (auto& client : Clients().clients) {
+			if (client->frozen_plugin == plugin)
+				client->Thaw(false);
+		}
+		for (auto& client : Clients().clients) {
+			client->watchpoints.Forget(plugin->GetBaseContext());
+			if (client->step_trap.ctx == plugin->GetBaseContext())
+				client->disarmStep();
+		}
+		watched_contexts.erase(plugin->GetBaseContext());
+		ForgetContext(plugin->GetBaseContext());
+		ResetContextState(plugin->GetBaseContext());
+		auto runtime = plugin->GetRuntime();
+		image_cache.Remove(runtime);
+		std::lock_guard<std::mutex> lock(breakpoint_maps_mtx);
+		breakpoint_maps.erase(runtime);
+		if (runtime == last_runtime) {
+			last_runtime = nullptr;
+			last_map = nullptr;
+		}
+	}
+} BreakpointListener;
+
+void AttachBreakpointMaps(ISourcePawnDebugHooks* hooks, bool background) {
+	patch_env = hooks;
+	if (background)
+		image_cache.StartWorker();
+	plsys->AddPluginsListener(&BreakpointListener);
+	g_pSM->AddGameFrameHook(&OnBreakpointsGameFrame);
+}
+
+void AttachDataWatchpoints(ISourcePawnDebugHooks* hooks) {
+	watch_env = hooks;
+}
+
+void AttachContextSlots() {
+	context_slots = true;
+}
+
+void DetachBreakpointMaps() {
+	g_pSM->RemoveGameFrameHook(&OnBreakpointsGameFrame);
+	plsys->RemovePluginsListener(&BreakpointListener);
+	image_cache.StopWorker();
+	context_states.clear();
+}
 
 void debugThread() {
 	auto service = TcpService::Create();
@@ -1178,18 +3227,19 @@ void debugThread() {
 
 	auto mainLoop = std::make_shared<EventLoop>();
 	auto enterCallback = [=](const TcpConnection::Ptr& session) {
-		addClientID(session);
+		std::weak_ptr<DebuggerClient> weak_client = addClientID(session);
 		session->setDisConnectCallback([=](
 			const TcpConnection::Ptr& session) {
 				removeClientID(session);
 			});
-		auto contentLength = std::make_shared<size_t>();
 		session->setDataCallback([=](brynet::base::BasePacketReader& reader) {
-			for (auto& client : clients) {
-				if (client->socket == session) {
-					client->RecvCmd(reader.begin(), reader.size());
-					break;
-				}
+			if (auto client = weak_client.lock()) {
+				// Whatever is not consumed stays in the receive buffer
+				// and is presented again with the next segment.
+				reader.addPos(client->RecvCmd(reader.currentBuffer(),
+					reader.getLeft()));
+				reader.savePos();
+				return;
 			}
 			reader.consumeAll();
 			});
@@ -1199,7 +3249,7 @@ void debugThread() {
 	listener.WithService(service)
 		.AddSocketProcess(
 			{ [](TcpSocket& socket) { socket.setNodelay(); } })
-		.WithMaxRecvBufferSize(1024 * 1024)
+		.WithMaxRecvBufferSize(kMaxRecvBufferSize)
 		.AddEnterCallback(enterCallback)
 		.WithAddr(false, "0.0.0.0", SM_Debugger_port())
 		.asyncRun();
@@ -1234,98 +3284,92 @@ void DebugReport::OnDebugSpew(const char* msg, ...) {
  */
 void DebugReport::ReportError(const IErrorReport& report,
 	IFrameIterator& iter) {
-	if (!clients.empty()) {
-		auto plugin = report.Context();
-		if (plugin) {
-
-			auto found = false;
-			/* first search already found attached hook */
-			for (auto& client : clients) {
-				if (client && client->context_ == iter.Context()) {
-					found = true;
-					client->ReportError(report, iter);
-					break;
-				}
-			}
-
-			/* if not found, search for new client who wants to attach to
-			 * current file */
-			if (!found) {
-				for (int i = 0; i < report.Context()
-					->GetRuntime()
-					->GetDebugInfo()
-					->NumFiles();
-					i++) {
-					auto filename = std::string(report.Context()
-						->GetRuntime()
-						->GetDebugInfo()
-						->GetFileName(i));
-
-					auto current_file = std::filesystem::path(filename).filename().string();
-					lowercase(current_file);
-
-					for (auto& client : clients) {
-						if (client->files.find(current_file) != client->files.end())
-						{
-							client->ReportError(report, iter);
-						}
-					}
-				}
-			}
+	if (!Clients().clients.empty() && report.Context()) {
+		for (auto client : SubscribersOf(report.Context())) {
+			client->ReportError(report, iter);
 		}
 	}
 
 	original->ReportError(report, iter);
 }
 
+/* -1 until a break shows whether the runtime reports the cell after a BREAK */
+static int break_cip_after_opcode = -1;
+
+/**
+ * @brief Maps the cip of a debug break to its BREAK opcode. The JIT reports
+ * the opcode's own address, while the interpreter has already read past the
+ * one-cell opcode; breakpoint maps and step traps hold opcode addresses.
+ * Game thread only.
+ */
+static cell_t BreakSite(const SmxV1Image* image, cell_t cip) {
+	auto code = image->DescribeCode();
+	auto is_break = [&](cell_t at) {
+		return at >= 0 && (size_t)at + sizeof(cell_t) <= code.length &&
+			*reinterpret_cast<const cell_t*>(code.bytes + at) == OP_BREAK;
+	};
+	bool here = is_break(cip);
+	bool before = is_break(cip - (cell_t)sizeof(cell_t));
+	/* BREAK, BREAK can't tell the runtimes apart */
+	if (here != before)
+		break_cip_after_opcode = before;
+	bool after = break_cip_after_opcode < 0 ? before : break_cip_after_opcode > 0;
+	return after && before ? cip - (cell_t)sizeof(cell_t) : cip;
+}
+
 void(DebugHandler)(SourcePawn::IPluginContext* IPlugin,
 	sp_debug_break_info_t& BreakInfo,
 	const SourcePawn::IErrorReport* IErrorReport) {
 	if (!IPlugin->IsDebugging())
 		return;
 
-	if (!clients.empty()) {
-		/* first search already found attached hook */
-		for (auto it = clients.begin(); it != clients.end(); ++it) {
-			const auto& client = *it;
-			if (client && client->context_ == IPlugin) {
-				try
-				{
-					client->DebugHook(IPlugin, BreakInfo);
-				}
-				catch (DebuggerClient::debugger_stopped& ex)
-				{
-					//it = clients.begin();
-					//continue;
-					return;
-				}
+	auto& registered = Clients();
+	if (!registered.clients.empty()) {
+		if (breakpoints_dirty)
+			RebuildBreakpointMaps();
+
+		/* fast path: not a breakpoint address and nobody is stepping */
+		bool stepping = false;
+		for (auto& client : registered.clients) {
+			if (client->IsStepping()) {
+				stepping = true;
+				break;
 			}
-			
 		}
-				
-		for (int i = 0;
-			i < IPlugin->GetRuntime()->GetDebugInfo()->NumFiles();
-			i++) {
-			auto filename =
-				IPlugin->GetRuntime()->GetDebugInfo()->GetFileName(
-					i);
-			auto current_file = std::filesystem::path(filename).filename().string();
-			lowercase(current_file);
+		auto& state = ContextState(IPlugin, BreakInfo);
+		if (!state.map)
+			state.map = FindBreakpointMap(IPlugin->GetRuntime());
+		bool watch_hit = WatchHit(BreakInfo) != nullptr;
+		if (!watch_hit && state.map->image())
+			BreakInfo.cip = BreakSite(state.map->image().get(), BreakInfo.cip);
+		if (!stepping && !watch_hit && !state.map->test(BreakInfo.cip)) {
+			state.lastline = 0;
+			return;
+		}
 
-			for (auto it = clients.begin(); it != clients.end(); ++it) {
-				const auto& client = *it;
-				if (client->files.find(current_file) != client->files.end())
-				{
-					try
-					{
-						client->DebugHook(IPlugin, BreakInfo);
-					}
-					catch (DebuggerClient::debugger_stopped& ex)
-					{
-						return;
-					}
-				}
-			}			
+		/* decided once for all clients, so one client's stop can't hide it from the next */
+		bool repeat = false;
+		if (!watch_hit && state.map->image()) {
+			uint32_t line = 0;
+			state.map->image()->LookupLine(BreakInfo.cip, &line);
+			repeat = line == state.lastline;
+			state.lastline = line;
 		}
+
+		/* the snapshot outlives this break even if clients come or go */
+		for (auto client : SubscribersOf(IPlugin)) {
+			try
+			{
+				client->DebugHook(IPlugin, BreakInfo, repeat);
+			}
+			catch (DebuggerClient::debugger_stopped& ex)
+			{
+				ApplyBreakpointPatches();
+				return;
+			}
+		}
+
+		/* the client may have started or stopped stepping while we were stopped */
+		ApplyBreakpointPatches();
 	}
 }
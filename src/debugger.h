@@ -13,6 +13,7 @@
 #include <sp_vm_types.h>
 #include <sp_vm_api.h>
 #include "sp_vm_debug_api.h"
+#include "sp_vm_debug_hooks.h"
 #include "plugin-context.h"
 #include <smx/smx-headers.h>
 #include <smx/smx-v1.h>
@@ -2,9 +2,16 @@
 #include "extension.h"
 #include <string>
 #include <thread>
+#include <filesystem>
 #include <fmt/format.h>
 
 #define LOWEST_SOURCEPAWN_API_VERSION 0x0207
+/* debugger hooks of our own runtime, absent from stock SourcePawn */
+#define LOWEST_DEBUG_HOOKS_VERSION 1
+/* first hooks version that can check plugin stores against data watch ranges */
+#define WATCH_DEBUG_HOOKS_VERSION 2
+/* first hooks version that reports the plugin's context slot with each break */
+#define SLOT_DEBUG_HOOKS_VERSION 3
 Extension g_zr;
 SMEXT_LINK(&g_zr);
 
@@ -38,12 +45,18 @@ extern void(DebugHandler)(SourcePawn::IPluginContext *IPlugin,
 						  const SourcePawn::IErrorReport *IErrorReport);
 
 extern void debugThread();
+extern void AttachBreakpointMaps(ISourcePawnDebugHooks *patch_env, bool background);
+extern void AttachDataWatchpoints(ISourcePawnDebugHooks *watch_env);
+extern void AttachContextSlots();
+extern void DetachBreakpointMaps();
 bool Inited = false;
 
 extern DebugReport DebugListener;
 
 uint16_t sm_debugger_port = 12345;
 float sm_debugger_delay = 0.f;
+uint32_t sm_debugger_compress_threshold = 8192;
+bool sm_debugger_soft_stop = false;
 int SM_Debugger_port()
 {
 	return sm_debugger_port;
@@ -52,6 +65,14 @@ float SM_Debugger_timeout()
 {
 	return sm_debugger_delay;
 }
+uint32_t SM_Debugger_compress_threshold()
+{
+	return sm_debugger_compress_threshold;
+}
+bool SM_Debugger_soft_stop()
+{
+	return sm_debugger_soft_stop;
+}
 /*
 
 bool Extension::SDK_OnMetamodLoad(ISmmAPI* ismm, char* error, size_t maxlen, bool late) {
@@ -75,10 +96,33 @@ bool Extension::SDK_OnLoad(char *error, size_t maxlen, bool late) {
 	}
 	ISourcePawnFactory *factory = nullptr;
 	GetSourcePawnFactoryFn factoryFn = nullptr;
+	GetSourcePawnDebugHooksFn hooksFn = nullptr;
 	ISourcePawnEnvironment *current_env = nullptr;
+	ISourcePawnDebugHooks *hooks = nullptr;
 	std::string modulename = "sourcepawn.jit.x86.";
 	const char* debugPort = g_pSM->GetCoreConfigValue("DebuggerPort");
 	const char* debugDelay = g_pSM->GetCoreConfigValue("DebuggerWaitTime");
+	const char* debugCompress = g_pSM->GetCoreConfigValue("DebuggerCompressThreshold");
+	const char* debugSoftStop = g_pSM->GetCoreConfigValue("DebuggerSoftStop");
+	/* pause only the stopped plugin instead of blocking the server */
+	sm_debugger_soft_stop = debugSoftStop && (!strcmp(debugSoftStop, "yes") || !strcmp(debugSoftStop, "1"));
+	const char* debugBackground = g_pSM->GetCoreConfigValue("DebuggerBackgroundValidation");
+	bool background = debugBackground && (!strcmp(debugBackground, "yes") || !strcmp(debugBackground, "1"));
+	const char* debugMapPlugins = g_pSM->GetCoreConfigValue("DebuggerMapPlugins");
+	/* map .smx files instead of copying them; they can't be rebuilt while mapped */
+	sp::SmxV1Image::SetMapPluginFiles(debugMapPlugins &&
+		(!strcmp(debugMapPlugins, "yes") || !strcmp(debugMapPlugins, "1")));
+	const char* debugImageCache = g_pSM->GetCoreConfigValue("DebuggerImageCache");
+	if (!debugImageCache || (strcmp(debugImageCache, "no") && strcmp(debugImageCache, "0")))
+	{
+		/* one inflated copy per compressed plugin, mapped on later loads */
+		char cachePath[PLATFORM_MAX_PATH];
+		g_pSM->BuildPath(Path_SM, cachePath, sizeof(cachePath), "data/sm_debugger/images");
+		std::error_code ec;
+		std::filesystem::create_directories(cachePath, ec);
+		if (!ec)
+			sp::SmxV1Image::SetDecompressedCacheDir(cachePath);
+	}
 	if(debugPort && debugPort[0])
 	{
 		try
@@ -123,11 +167,25 @@ bool Extension::SDK_OnLoad(char *error, size_t maxlen, bool late) {
 	{
 		fmt::print("[SM_DEBUGGER] DebuggerWaitTime is not exists in core.cfg. Setting default delay 0.\n");		
 	}
+	if (debugCompress && debugCompress[0])
+	{
+		/* payloads larger than this many bytes are compressed, 0 disables */
+		try
+		{
+			sm_debugger_compress_threshold = std::stoul(debugCompress);
+		}
+		catch (...) {
+			fmt::print("Can't convert DebuggerCompressThreshold from core.cfg. [%s]\n", debugCompress);
+		}
+	}
 	modulename += PLATFORM_LIB_EXT;
 	auto module = GetModuleHandle(modulename.c_str());
 	if (module) {
 		factoryFn = GetSourcePawnFactoryFn(
 			GetProcAddress((HMODULE)module, "GetSourcePawnFactory"));
+		/* only exported by our runtime; ApiVersion can't tell it from stock */
+		hooksFn = GetSourcePawnDebugHooksFn(
+			GetProcAddress((HMODULE)module, "GetSourcePawnDebugHooks"));
 	}
 	if (factoryFn) {
 		factory = factoryFn(LOWEST_SOURCEPAWN_API_VERSION);
@@ -135,12 +193,28 @@ bool Extension::SDK_OnLoad(char *error, size_t maxlen, bool late) {
 	if (factory) {
 		current_env = factory->CurrentEnvironment();
 	}
+	if (hooksFn) {
+		hooks = hooksFn(LOWEST_DEBUG_HOOKS_VERSION);
+	}
 	if (current_env) {
 		if (!Inited) {
 			std::thread(debugThread).detach();
 			Inited = true;
 		}
-		current_env->EnableDebugBreak();
+		if (hooks && hooks->EnablePatchableDebugBreak()) {
+			AttachBreakpointMaps(hooks, background);
+		}
+		else {
+			current_env->EnableDebugBreak();
+			AttachBreakpointMaps(nullptr, background);
+		}
+		if (hooks && hooks->Version() >= WATCH_DEBUG_HOOKS_VERSION &&
+			hooks->EnableDataWatchpoints()) {
+			AttachDataWatchpoints(hooks);
+		}
+		if (hooks && hooks->Version() >= SLOT_DEBUG_HOOKS_VERSION) {
+			AttachContextSlots();
+		}
 		DebugListener.original = current_env->APIv1()->SetDebugListener(&DebugListener);
 		current_env->APIv1()->SetDebugBreakHandler(DebugHandler);
 		std::this_thread::sleep_for(std::chrono::duration<float>(SM_Debugger_timeout()));
@@ -161,12 +235,13 @@ void Extension::SDK_OnUnload()
 			GetProcAddress((HMODULE)module, "GetSourcePawnFactory"));
 	}
 	if (factoryFn) {
-		factory = factoryFn(SOURCEPAWN_API_VERSION);
+		factory = factoryFn(LOWEST_SOURCEPAWN_API_VERSION);
 	}
 	if (factory) {
 		current_env = factory->CurrentEnvironment();
 	}
 	if (current_env) {
+		DetachBreakpointMaps();
 		current_env->APIv1()->SetDebugListener(DebugListener.original);
 	}
 }
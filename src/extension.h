@@ -20,5 +20,7 @@ public: // IConCommandBaseAccessor
 };
 extern int SM_Debugger_port();
 extern float SM_Debugger_timeout();
+extern uint32_t SM_Debugger_compress_threshold();
+extern bool SM_Debugger_soft_stop();
 
 #endif
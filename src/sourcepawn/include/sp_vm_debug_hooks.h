@@ -0,0 +1,78 @@
+// vim: set ts=4 sw=4 tw=99 et:
+//
+// This file is part of sm-debugger. It declares debugger hooks that only the
+// runtime built from src/sourcepawn/vm provides; they are not part of
+// upstream SourcePawn.
+//
+#ifndef _INCLUDE_SOURCEPAWN_VM_DEBUG_HOOKS_H_
+#define _INCLUDE_SOURCEPAWN_VM_DEBUG_HOOKS_H_
+
+#include "sp_vm_api.h"
+
+// Versioned independently of SOURCEPAWN_API_VERSION, which belongs to
+// upstream. Methods are only ever appended.
+//   1: patchable debug breaks
+//   2: data watchpoints, sp_debug_break_info_ex_t
+//   3: sp_debug_break_info_ex_t::context_slot
+#define SOURCEPAWN_DEBUG_HOOKS_VERSION 3
+
+// @brief Break info passed to the debug break handler by runtimes with
+// hooks version 2 or later. A handler may only treat the
+// sp_debug_break_info_t it receives as this type after
+// GetSourcePawnDebugHooks reported such a version; version stays the
+// upstream DEBUG_BREAK_INFO_VERSION.
+struct sp_debug_break_info_ex_t : public sp_debug_break_info_t
+{
+    cell_t watch_addr; /**< Address written to, for a data watchpoint hit */
+    cell_t watch_size; /**< Bytes written, or 0 if this is not a data watchpoint hit */
+    uint32_t context_slot; /**< Small index of the plugin, unique while it is loaded (version 3) */
+};
+
+namespace SourcePawn
+{
+    // @brief Debugger hooks of the sm-debugger runtime.
+    //
+    // A stock runtime does not export GetSourcePawnDebugHooks, so the
+    // debugger must not assume any of this exists until that lookup
+    // succeeds.
+    class ISourcePawnDebugHooks
+    {
+      public:
+        // @brief Returns the highest hooks version the runtime implements.
+        virtual int Version() = 0;
+
+        // @brief Enables the line debugger, but compiles each BREAK site as a
+        // patchable no-op. Sites only invoke the debug break handler once they
+        // are armed with SetDebugBreakSite or SetAllDebugBreakSites. This must
+        // be called before any plugins are loaded.
+        virtual bool EnablePatchableDebugBreak() = 0;
+
+        // @brief Arms or disarms the BREAK site at the given cip. This must be
+        // called from the thread that executes plugin code.
+        virtual void SetDebugBreakSite(IPluginRuntime* runtime, ucell_t cip, bool armed) = 0;
+
+        // @brief Arms or disarms every BREAK site of a plugin, e.g. while the
+        // debugger is stepping. Sites armed individually stay armed when this
+        // is turned off again.
+        virtual void SetAllDebugBreakSites(IPluginRuntime* runtime, bool armed) = 0;
+
+        // @brief Enables data watchpoints (version 2). Stores into plugin
+        // memory that may reach the data section are compiled with a range
+        // check, and a store into a plugin's watched range invokes the debug
+        // break handler with watch_addr and watch_size set. Requires the line
+        // debugger. This must be called before any plugins are loaded.
+        virtual bool EnableDataWatchpoints() = 0;
+
+        // @brief Sets the watched address range of a plugin (version 2). A
+        // size of 0 disarms it. This must be called from the thread that
+        // executes plugin code.
+        virtual void SetDataWatchRange(IPluginRuntime* runtime, ucell_t addr, ucell_t size) = 0;
+    };
+
+    // @brief A function named "GetSourcePawnDebugHooks" is exported from the
+    // sm-debugger runtime only. It returns nullptr if the runtime does not
+    // implement the requested version.
+    typedef ISourcePawnDebugHooks* (*GetSourcePawnDebugHooksFn)(int version);
+} // namespace SourcePawn
+
+#endif // _INCLUDE_SOURCEPAWN_VM_DEBUG_HOOKS_H_
@@ -47,6 +47,13 @@ class BitSet
     words_[word] |= (uintptr_t(1) << pos_in_word(bit));
   }
 
+  void clear(uintptr_t bit) {
+    size_t word = word_for_bit(bit);
+    if (word >= words_.length())
+      return;
+    words_[word] &= ~(uintptr_t(1) << pos_in_word(bit));
+  }
+
   void for_each(const ke::Function<void(uintptr_t)>& callback) {
     for (size_t i = 0; i < words_.length(); i++) {
       uintptr_t word = words_[i];
@@ -13,45 +13,102 @@
 #include "compiled-function.h"
 #include "environment.h"
 #include <amtl/am-platform.h>
+#include <algorithm>
+#include <string.h>
 
 using namespace sp;
 
 CompiledFunction::CompiledFunction(const CodeChunk& code,
                                    cell_t pcode_offs,
                                    FixedArray<LoopEdge>* edges,
-                                   FixedArray<CipMapEntry>* cipmap)
+                                   FixedArray<CipMapEntry>* cipmap,
+                                   FixedArray<BreakSite>* break_sites,
+                                   uint32_t debug_break_offset)
  : code_(code),
    code_offset_(pcode_offs),
    edges_(edges),
    cip_map_(cipmap),
-   cip_map_sorted_(false)
+   break_sites_(break_sites),
+   debug_break_offset_(debug_break_offset)
 {
+  BuildCipBuckets();
 }
 
 CompiledFunction::~CompiledFunction()
 {
 }
 
-static int cip_map_entry_sort_cmp(const void* a1, const void* a2)
+void
+CompiledFunction::PatchBreakSite(size_t i, bool armed)
 {
-  const CipMapEntry* c1 = reinterpret_cast<const CipMapEntry*>(a1);
-  const CipMapEntry* c2 = reinterpret_cast<const CipMapEntry*>(a2);
-  if (c1->pcoffs < c2->pcoffs)
-    return -1;
-  if (c1->pcoffs == c2->pcoffs)
-    return 0;
-  return 1;
+  BreakSite& site = break_sites_->at(i);
+  if (site.armed == armed)
+    return;
+
+  uint8_t* pc = reinterpret_cast<uint8_t*>(code_.address()) + site.pcoffs;
+  if (armed) {
+    // call rel32, relative to the end of the instruction. Write the
+    // displacement before the opcode so the site never decodes as a call
+    // to a stale target.
+    *reinterpret_cast<int32_t*>(pc + 1) =
+      int32_t(debug_break_offset_) - int32_t(site.pcoffs + 5);
+    pc[0] = 0xe8;
+  } else {
+    static const uint8_t kNop5[] = { 0x0f, 0x1f, 0x44, 0x00, 0x00 };
+    memcpy(pc, kNop5, sizeof(kNop5));
+  }
+  site.armed = armed;
 }
 
-static int cip_map_entry_cmp(const void* a1, const void* aEntry)
+// Call sites are a few instructions apart, so a bucket rarely holds more
+// than one or two mappings.
+static const uint32_t kCipBucketShift = 4;
+static const uint32_t kCipBucketSize = 1 << kCipBucketShift;
+
+void
+CompiledFunction::BuildCipBuckets()
 {
-  uint32_t pcoffs = (uint32_t)(intptr_t)a1;
-  const CipMapEntry* entry = reinterpret_cast<const CipMapEntry*>(aEntry);
-  if (pcoffs < entry->pcoffs)
-    return -1;
-  if (pcoffs == entry->pcoffs)
-    return 0;
-  return pcoffs > entry->pcoffs;
+  const CipMapEntry* entries = cip_map_->buffer();
+  size_t count = cip_map_->length();
+  assert(std::is_sorted(entries, entries + count,
+                        [](const CipMapEntry& a, const CipMapEntry& b) {
+                          return a.pcoffs < b.pcoffs;
+                        }));
+  if (count >= 0xffff)
+    return;
+
+  // A return address may sit at the very end of the code.
+  size_t nbuckets = (code_.bytes() >> kCipBucketShift) + 1;
+  cip_buckets_ = new FixedArray<uint16_t>(nbuckets);
+
+  size_t entry = 0;
+  for (size_t bucket = 0; bucket < nbuckets; bucket++) {
+    while (entry < count && entries[entry].pcoffs < bucket * kCipBucketSize)
+      entry++;
+    cip_buckets_->at(bucket) = uint16_t(entry);
+  }
+}
+
+const CipMapEntry*
+CompiledFunction::FindCipMapEntry(uint32_t pcoffs) const
+{
+  const CipMapEntry* entries = cip_map_->buffer();
+  const CipMapEntry* end = entries + cip_map_->length();
+
+  const CipMapEntry* iter;
+  if (cip_buckets_) {
+    iter = entries + cip_buckets_->at(pcoffs >> kCipBucketShift);
+    while (iter != end && iter->pcoffs < pcoffs)
+      iter++;
+  } else {
+    iter = std::lower_bound(entries, end, pcoffs,
+                            [](const CipMapEntry& entry, uint32_t pcoffs) {
+                              return entry.pcoffs < pcoffs;
+                            });
+  }
+  if (iter == end || iter->pcoffs != pcoffs)
+    return nullptr;
+  return iter;
 }
 
 ucell_t
@@ -64,26 +121,13 @@ CompiledFunction::FindCipByPc(void* pc)
   if (pcoffs > code_.bytes())
     return kInvalidCip;
 
-  if (!cip_map_sorted_) {
-    qsort(cip_map_->buffer(),
-          cip_map_->length(),
-          sizeof(CipMapEntry),
-          cip_map_entry_sort_cmp);
-    cip_map_sorted_ = true;
-  }
-
-  void* ptr = bsearch(
-    (void*)(uintptr_t)pcoffs,
-    cip_map_->buffer(),
-    cip_map_->length(),
-    sizeof(CipMapEntry),
-    cip_map_entry_cmp);
-  assert(ptr);
+  const CipMapEntry* entry = FindCipMapEntry(pcoffs);
+  assert(entry);
 
-  if (!ptr) {
+  if (!entry) {
     // Shouldn't happen, but fail gracefully.
     return kInvalidCip;
   }
 
-  return code_offset_ + reinterpret_cast<CipMapEntry*>(ptr)->cipoffs;
+  return code_offset_ + entry->cipoffs;
 }
@@ -42,6 +42,17 @@ struct CipMapEntry {
   uint32_t pcoffs;
 };
 
+// A BREAK opcode compiled in patchable mode. The site is five bytes long and
+// holds either a call to the debug break thunk or a five-byte nop.
+struct BreakSite {
+  // Offset from the first cip of the function.
+  uint32_t cipoffs;
+  // Offset from the first pc of the function to the start of the site.
+  uint32_t pcoffs;
+  // Whether the site currently holds a call.
+  bool armed;
+};
+
 static const ucell_t kInvalidCip = 0xffffffff;
 
 class CompiledFunction
@@ -50,7 +61,9 @@ class CompiledFunction
   CompiledFunction(const CodeChunk& code,
                    cell_t pcode_offs,
                    FixedArray<LoopEdge>* edges,
-                   FixedArray<CipMapEntry>* cip_map);
+                   FixedArray<CipMapEntry>* cip_map,
+                   FixedArray<BreakSite>* break_sites = nullptr,
+                   uint32_t debug_break_offset = 0);
   ~CompiledFunction();
 
  public:
@@ -67,14 +80,35 @@ class CompiledFunction
     return edges_->at(i);
   }
 
+  uint32_t NumBreakSites() const {
+    return break_sites_ ? break_sites_->length() : 0;
+  }
+  const BreakSite& GetBreakSite(size_t i) const {
+    return break_sites_->at(i);
+  }
+
+  // Rewrite a patchable BREAK site into a call to the debug break thunk, or
+  // back into a nop. The caller must own the environment lock.
+  void PatchBreakSite(size_t i, bool armed);
+
   ucell_t FindCipByPc(void* pc);
 
+ private:
+  void BuildCipBuckets();
+  const CipMapEntry* FindCipMapEntry(uint32_t pcoffs) const;
+
  private:
   CodeChunk code_;
   cell_t code_offset_;
   AutoPtr<FixedArray<LoopEdge>> edges_;
+  // Sorted by pcoffs; the JIT emits mappings in code order.
   AutoPtr<FixedArray<CipMapEntry>> cip_map_;
-  bool cip_map_sorted_;
+  // For each kCipBucketSize bytes of code, the index of the first cip map
+  // entry at or after the bucket's start, so a lookup only scans the few
+  // entries of one bucket. Null if the map is too large for 16-bit indexes.
+  AutoPtr<FixedArray<uint16_t>> cip_buckets_;
+  AutoPtr<FixedArray<BreakSite>> break_sites_;
+  uint32_t debug_break_offset_;
 };
 
 }
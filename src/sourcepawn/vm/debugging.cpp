@@ -15,10 +15,12 @@
 #include "environment.h"
 #include "watchdog_timer.h"
 #include <amtl/am-raii.h>
+#include <sp_vm_debug_hooks.h>
 
 namespace sp {
 
-void InvokeDebugger(PluginContext* ctx, const IErrorReport* report)
+static void InvokeDebugBreak(PluginContext* ctx, const IErrorReport* report,
+                             cell_t watch_addr, cell_t watch_size)
 {
   // Continue normal execution, if there is no listener registered.
   if (!Environment::get()->debugbreak())
@@ -49,14 +51,29 @@ void InvokeDebugger(PluginContext* ctx, const IErrorReport* report)
   // continueing with execution.
   ke::SaveAndSet<bool> disableWatchdog(&Environment::get()->watchdog()->ignore_timeout_, true);
 
-  // Fill in the debug info struct.
-  sp_debug_break_info_t dbginfo;
+  // Fill in the debug info struct. The extended fields are only read by
+  // handlers that found our debug hooks.
+  sp_debug_break_info_ex_t dbginfo;
   dbginfo.version = DEBUG_BREAK_INFO_VERSION;
   dbginfo.cip = cip;
   dbginfo.frm = ctx->frm();
+  dbginfo.watch_addr = watch_addr;
+  dbginfo.watch_size = watch_size;
+  dbginfo.context_slot = ctx->runtime()->context_slot();
 
   // Call debug callback.
   Environment::get()->debugbreak()(ctx, dbginfo, report);
 }
 
+void InvokeDebugger(PluginContext* ctx, const IErrorReport* report)
+{
+  InvokeDebugBreak(ctx, report, 0, 0);
+}
+
+// Called after a store into the plugin's watched data range.
+void InvokeDataWatch(PluginContext* ctx, cell_t addr, cell_t size)
+{
+  InvokeDebugBreak(ctx, nullptr, addr, size);
+}
+
 } // namespace sp
@@ -23,6 +23,7 @@
 namespace sp {
 
 void InvokeDebugger(PluginContext* ctx, const IErrorReport* report);
+void InvokeDataWatch(PluginContext* ctx, cell_t addr, cell_t size);
 
 } // namespace sp
 
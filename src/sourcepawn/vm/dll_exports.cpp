@@ -11,6 +11,7 @@
 // SourcePawn. If not, see http://www.gnu.org/licenses/.
 //
 #include <sp_vm_api.h>
+#include <sp_vm_debug_hooks.h>
 #include <stdlib.h>
 #include <stdarg.h>
 #include <am-cxx.h>
@@ -36,6 +37,29 @@ public:
 	}
 } sFactory;
 
+class SourcePawnDebugHooks : public ISourcePawnDebugHooks
+{
+public:
+	int Version() override {
+		return SOURCEPAWN_DEBUG_HOOKS_VERSION;
+	}
+	bool EnablePatchableDebugBreak() override {
+		return Environment::get()->EnablePatchableDebugBreak();
+	}
+	void SetDebugBreakSite(IPluginRuntime* runtime, ucell_t cip, bool armed) override {
+		Environment::get()->SetDebugBreakSite(runtime, cip, armed);
+	}
+	void SetAllDebugBreakSites(IPluginRuntime* runtime, bool armed) override {
+		Environment::get()->SetAllDebugBreakSites(runtime, armed);
+	}
+	bool EnableDataWatchpoints() override {
+		return Environment::get()->EnableDataWatchpoints();
+	}
+	void SetDataWatchRange(IPluginRuntime* runtime, ucell_t addr, ucell_t size) override {
+		Environment::get()->SetDataWatchRange(runtime, addr, size);
+	}
+} sDebugHooks;
+
 #define MIN_API_VERSION 0x0207
 
 EXPORTFUNC ISourcePawnFactory*
@@ -46,6 +70,16 @@ GetSourcePawnFactory(int apiVersion)
 	return &sFactory;
 }
 
+// Not part of upstream SourcePawn; lets the debugger tell this runtime
+// apart from a stock one.
+EXPORTFUNC ISourcePawnDebugHooks*
+GetSourcePawnDebugHooks(int version)
+{
+	if (version < 1 || version > SOURCEPAWN_DEBUG_HOOKS_VERSION)
+		return nullptr;
+	return &sDebugHooks;
+}
+
 #if defined __linux__ || defined __APPLE__
 # if !defined(_GLIBCXX_USE_NOEXCEPT)
 #  define _GLIBCXX_USE_NOEXCEPT
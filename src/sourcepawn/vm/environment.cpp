@@ -34,6 +34,8 @@ static Environment* sEnvironment = nullptr;
 
 Environment::Environment()
  : debug_break_enabled_(false),
+   debug_break_patchable_(false),
+   data_watch_enabled_(false),
    debug_break_handler_(nullptr),
    debugger_(nullptr),
    eh_top_(nullptr),
@@ -45,6 +47,7 @@ Environment::Environment()
    jit_enabled_(false),
 #endif
    profiling_enabled_(false),
+   next_context_slot_(0),
    top_(nullptr)
 {
 }
@@ -126,6 +129,81 @@ Environment::EnableDebugBreak()
   return true;
 }
 
+bool
+Environment::EnablePatchableDebugBreak()
+{
+  if (!EnableDebugBreak())
+    return false;
+
+  debug_break_patchable_ = true;
+  return true;
+}
+
+void
+Environment::SetDebugBreakSite(IPluginRuntime* runtime, ucell_t cip, bool armed)
+{
+  if (!debug_break_patchable_)
+    return;
+
+  PluginRuntime* rt = PluginRuntime::FromAPI(runtime);
+  rt->SetDebugBreakArmed(cip, armed);
+
+  ke::AutoLock lock(&mutex_);
+  rt->PatchBreakSite(cip);
+}
+
+void
+Environment::SetAllDebugBreakSites(IPluginRuntime* runtime, bool armed)
+{
+  if (!debug_break_patchable_)
+    return;
+
+  PluginRuntime* rt = PluginRuntime::FromAPI(runtime);
+  rt->SetAllDebugBreaksArmed(armed);
+
+  ke::AutoLock lock(&mutex_);
+  PatchDebugBreakSites(rt);
+}
+
+bool
+Environment::EnableDataWatchpoints()
+{
+  if (!debug_break_enabled_)
+    return false;
+
+  data_watch_enabled_ = true;
+  return true;
+}
+
+void
+Environment::SetDataWatchRange(IPluginRuntime* runtime, ucell_t addr, ucell_t size)
+{
+  if (!data_watch_enabled_)
+    return;
+
+  PluginRuntime::FromAPI(runtime)->SetDataWatchRange(addr, size);
+}
+
+void
+Environment::PatchDebugBreakSites(PluginRuntime* rt)
+{
+  mutex_.AssertCurrentThreadOwns();
+
+  // Functions that have not been compiled yet pick up the armed state when
+  // the JIT reaches their BREAK opcodes.
+  const std::vector<RefPtr<MethodInfo>>& methods = rt->AllMethods();
+  for (size_t i = 0; i < methods.size(); i++) {
+    CompiledFunction* fun = methods[i]->jit();
+    if (!fun)
+      continue;
+
+    for (size_t j = 0; j < fun->NumBreakSites(); j++) {
+      ucell_t cip = fun->GetCodeOffset() + fun->GetBreakSite(j).cipoffs;
+      fun->PatchBreakSite(j, rt->IsDebugBreakArmed(cip));
+    }
+  }
+}
+
 void
 Environment::EnableProfiling()
 {
@@ -212,6 +290,13 @@ Environment::RegisterRuntime(PluginRuntime* rt)
 {
   mutex_.AssertCurrentThreadOwns();
   runtimes_.append(rt);
+
+  if (free_context_slots_.empty()) {
+    rt->set_context_slot(next_context_slot_++);
+  } else {
+    rt->set_context_slot(free_context_slots_.back());
+    free_context_slots_.pop_back();
+  }
 }
 
 void
@@ -219,6 +304,7 @@ Environment::DeregisterRuntime(PluginRuntime* rt)
 {
   mutex_.AssertCurrentThreadOwns();
   runtimes_.remove(rt);
+  free_context_slots_.push_back(rt->context_slot());
 }
 
 static inline void
@@ -17,6 +17,7 @@
 #include <amtl/am-cxx.h>
 #include <amtl/am-inlinelist.h>
 #include <amtl/am-thread-utils.h>
+#include <vector>
 #include "code-allocator.h"
 #include "plugin-runtime.h"
 #include "stack-frames.h"
@@ -117,9 +118,22 @@ class Environment : public ISourcePawnEnvironment
     return debugger_;
   }
 
+  // sm-debugger hooks; see ISourcePawnDebugHooks.
+  bool EnablePatchableDebugBreak();
+  void SetDebugBreakSite(IPluginRuntime* runtime, ucell_t cip, bool armed);
+  void SetAllDebugBreakSites(IPluginRuntime* runtime, bool armed);
+  bool EnableDataWatchpoints();
+  void SetDataWatchRange(IPluginRuntime* runtime, ucell_t addr, ucell_t size);
+
   bool IsDebugBreakEnabled() const {
     return debug_break_enabled_;
   }
+  bool IsDebugBreakPatchable() const {
+    return debug_break_patchable_;
+  }
+  bool IsDataWatchEnabled() const {
+    return data_watch_enabled_;
+  }
   void SetDebugBreakHandler(SPVM_DEBUGBREAK handler) {
     debug_break_handler_ = handler;
   }
@@ -173,6 +187,7 @@ class Environment : public ISourcePawnEnvironment
   bool Initialize();
 
   void DispatchReport(const ErrorReport& report);
+  void PatchDebugBreakSites(PluginRuntime* rt);
 
  private:
   ke::AutoPtr<ISourcePawnEngine> api_v1_;
@@ -182,6 +197,8 @@ class Environment : public ISourcePawnEnvironment
   ke::Mutex mutex_;
 
   bool debug_break_enabled_;
+  bool debug_break_patchable_;
+  bool data_watch_enabled_;
   SPVM_DEBUGBREAK debug_break_handler_;
 
   IDebugListener* debugger_;
@@ -197,6 +214,8 @@ class Environment : public ISourcePawnEnvironment
   ke::AutoPtr<CodeStubs> code_stubs_;
 
   ke::InlineList<PluginRuntime> runtimes_;
+  std::vector<uint32_t> free_context_slots_;
+  uint32_t next_context_slot_;
 
   uintptr_t frame_id_;
 
@@ -13,6 +13,13 @@
 
 #include <memory>
 
+#if defined(_WIN32)
+# include <windows.h>
+# include <io.h>
+#else
+# include <sys/mman.h>
+#endif
+
 using namespace sp;
 
 FileType
@@ -28,8 +35,10 @@ sp::DetectFileType(FILE* fp)
   return FileType::UNKNOWN;
 }
 
-FileReader::FileReader(FILE* fp)
- : length_(0)
+FileReader::FileReader(FILE* fp, bool map_file)
+ : mapped_(nullptr),
+   mapped_length_(0),
+   length_(0)
 {
   if (fseek(fp, 0, SEEK_END) != 0)
     return;
@@ -39,6 +48,9 @@ FileReader::FileReader(FILE* fp)
   if (fseek(fp, 0, SEEK_SET) != 0)
     return;
 
+  if (map_file && size > 0 && map(fp, size))
+    return;
+
   std::unique_ptr<uint8_t[]> bytes = std::make_unique<uint8_t[]>(size);
   if (!bytes || fread(bytes.get(), sizeof(uint8_t), size, fp) != (size_t)size)
     return;
@@ -48,8 +60,66 @@ FileReader::FileReader(FILE* fp)
 }
 
 FileReader::FileReader(std::unique_ptr<uint8_t[]>&& buffer, size_t length)
- : buffer_(std::move(buffer))
- ,
+ : buffer_(std::move(buffer)),
+   mapped_(nullptr),
+   mapped_length_(0),
    length_(length)
 {
 }
+
+FileReader::~FileReader()
+{
+  unmap();
+}
+
+bool
+FileReader::map(FILE* fp, size_t size)
+{
+  // Map copy-on-write: the image is patched in place (e.g. symbol display
+  // flags), and those writes must never reach the file.
+#if defined(_WIN32)
+  HANDLE file = (HANDLE)_get_osfhandle(_fileno(fp));
+  if (file == INVALID_HANDLE_VALUE)
+    return false;
+  HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+  if (!mapping)
+    return false;
+  void* view = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, size);
+  CloseHandle(mapping);
+  if (!view)
+    return false;
+#else
+  void* view = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(fp), 0);
+  if (view == MAP_FAILED)
+    return false;
+#endif
+
+  unmap();
+  buffer_ = nullptr;
+  mapped_ = reinterpret_cast<uint8_t*>(view);
+  mapped_length_ = size;
+  length_ = size;
+  return true;
+}
+
+void
+FileReader::reset(std::unique_ptr<uint8_t[]>&& buffer, size_t length)
+{
+  unmap();
+  buffer_ = std::move(buffer);
+  length_ = length;
+}
+
+void
+FileReader::unmap()
+{
+  if (!mapped_)
+    return;
+#if defined(_WIN32)
+  UnmapViewOfFile(mapped_);
+#else
+  munmap(mapped_, mapped_length_);
+#endif
+  mapped_ = nullptr;
+  mapped_length_ = 0;
+}
@@ -25,21 +25,43 @@ enum class FileType {
 
 FileType DetectFileType(FILE* fp);
 
+// Reads a whole file into memory. With map_file, and when the platform
+// allows it, the file is mapped privately instead: pages stay shared with
+// the page cache until something writes to them. A mapped file must not be
+// rewritten while the reader lives; on Linux that faults or mixes contents
+// into the image, on Windows the writer cannot truncate it.
 class FileReader
 {
  public:
-  FileReader(FILE* fp);
+  FileReader(FILE* fp, bool map_file = false);
   FileReader(std::unique_ptr<uint8_t[]>&& buffer, size_t length);
+  ~FileReader();
+
+  FileReader(const FileReader& other) = delete;
+  FileReader& operator =(const FileReader& other) = delete;
 
   const uint8_t* buffer() const {
-    return buffer_.get();
+    return mapped_ ? mapped_ : buffer_.get();
   }
   size_t length() const {
     return length_;
   }
+  bool mapped() const {
+    return !!mapped_;
+  }
+
+ protected:
+  // Replace the contents with a mapping of |fp|, or with a heap buffer.
+  bool map(FILE* fp, size_t size);
+  void reset(std::unique_ptr<uint8_t[]>&& buffer, size_t length);
+
+ private:
+  void unmap();
 
  protected:
   std::unique_ptr<uint8_t[]> buffer_;
+  uint8_t* mapped_;
+  size_t mapped_length_;
   size_t length_;
 };
 
@@ -180,7 +180,9 @@ Interpreter::visitLOAD_I()
 bool
 Interpreter::visitSTOR_I()
 {
-  return cx_->setCellValue(regs_.alt(), regs_.pri());
+  if (!cx_->setCellValue(regs_.alt(), regs_.pri()))
+    return false;
+  return watchStore(regs_.alt(), sizeof(cell_t));
 }
 
 bool
@@ -227,7 +229,9 @@ Interpreter::visitZERO(PawnReg dest)
 bool
 Interpreter::visitZERO(cell_t address)
 {
-  return cx_->setCellValue(address, 0);
+  if (!cx_->setCellValue(address, 0))
+    return false;
+  return watchStore(address, sizeof(cell_t));
 }
 
 bool
@@ -265,7 +269,9 @@ Interpreter::visitCONST(PawnReg dest, cell_t imm)
 bool
 Interpreter::visitCONST(cell_t address, cell_t value)
 {
-  return cx_->setCellValue(address, value);
+  if (!cx_->setCellValue(address, value))
+    return false;
+  return watchStore(address, sizeof(cell_t));
 }
 
 bool
@@ -405,7 +411,7 @@ Interpreter::visitINC(cell_t address)
   if (!addr)
     return false;
   *addr += 1;
-  return true;
+  return watchStore(address, sizeof(cell_t));
 }
 
 bool
@@ -424,7 +430,7 @@ Interpreter::visitINC_I()
   if (!addr)
     return false;
   *addr += 1;
-  return true;
+  return watchStore(regs_.pri(), sizeof(cell_t));
 }
 
 bool
@@ -441,7 +447,7 @@ Interpreter::visitDEC(cell_t address)
   if (!addr)
     return false;
   *addr -= 1;
-  return true;
+  return watchStore(address, sizeof(cell_t));
 }
 
 bool
@@ -460,7 +466,7 @@ Interpreter::visitDEC_I()
   if (!addr)
     return false;
   *addr -= 1;
-  return true;
+  return watchStore(regs_.pri(), sizeof(cell_t));
 }
 
 bool
@@ -633,7 +639,7 @@ Interpreter::visitMOVS(uint32_t amount)
   if (!dest)
     return false;
   memmove(dest, src, amount);
-  return true;
+  return watchStore(regs_.alt(), amount);
 }
 
 bool
@@ -644,7 +650,7 @@ Interpreter::visitFILL(uint32_t amount)
     return false;
   for (size_t i = 0; i < (amount / sizeof(cell_t)); i++)
     dest[i] = regs_.pri();
-  return true;
+  return watchStore(regs_.alt(), amount);
 }
 
 bool
@@ -700,7 +706,9 @@ Interpreter::visitSREF_S(cell_t destoffs, PawnReg src)
   cell_t address;
   if (!cx_->getFrameValue(destoffs, &address))
     return false;
-  return cx_->setCellValue(address, regs_[src]);
+  if (!cx_->setCellValue(address, regs_[src]))
+    return false;
+  return watchStore(address, sizeof(cell_t));
 }
 
 bool
@@ -744,7 +752,7 @@ Interpreter::visitSTRB_I(cell_t width)
   default:
     assert(false);
   }
-  return true;
+  return watchStore(regs_.alt(), width);
 }
 
 bool
@@ -756,7 +764,9 @@ Interpreter::visitLOAD(PawnReg dest, cell_t srcaddr)
 bool
 Interpreter::visitSTOR(cell_t address, PawnReg src)
 {
-  return cx_->setCellValue(address, regs_[src]);
+  if (!cx_->setCellValue(address, regs_[src]))
+    return false;
+  return watchStore(address, sizeof(cell_t));
 }
 
 bool
@@ -1040,10 +1050,28 @@ Interpreter::visitBREAK()
   if (!Environment::get()->IsDebugBreakEnabled())
     return true;
 
+  // In patchable mode, only armed sites reach the debugger. The reader has
+  // already moved past this one-cell opcode.
+  if (Environment::get()->IsDebugBreakPatchable() &&
+      !rt_->IsDebugBreakArmed(reader_.cip_offset() - sizeof(cell_t)))
+  {
+    return true;
+  }
+
   InvokeDebugger(cx_, nullptr);
   return !env_->hasPendingException();
 }
 
+bool
+Interpreter::watchStore(cell_t address, cell_t size)
+{
+  if (!env_->IsDataWatchEnabled() || !rt_->IsDataWatched(address, size))
+    return true;
+
+  InvokeDataWatch(cx_, address, size);
+  return !env_->hasPendingException();
+}
+
 bool
 Interpreter::visitHALT(cell_t value)
 {
@@ -163,6 +163,7 @@ class Interpreter final : public PcodeVisitor
 
  private:
   bool invokeNative(uint32_t native_index);
+  bool watchStore(cell_t address, cell_t size);
 
  private:
   Environment* env_;
@@ -144,6 +144,10 @@ CompilerBase::emit()
   // Common path for invoking line debugger.
   emitDebugBreakHandler();
 
+  // Common path for stores that hit a data watchpoint.
+  if (data_watch_.used())
+    emitDataWatchHandler();
+
   // This has to come very, very last, since it checks whether return paths
   // are used.
   emitErrorHandlers();
@@ -169,8 +173,15 @@ CompilerBase::emit()
     new FixedArray<CipMapEntry>(cip_map_.length()));
   memcpy(cipmap->buffer(), cip_map_.buffer(), cip_map_.length() * sizeof(CipMapEntry));
 
+  AutoPtr<FixedArray<BreakSite>> break_sites;
+  if (break_sites_.length()) {
+    break_sites = new FixedArray<BreakSite>(break_sites_.length());
+    memcpy(break_sites->buffer(), break_sites_.buffer(), break_sites_.length() * sizeof(BreakSite));
+  }
+
   assert(error_ == SP_ERROR_NONE);
-  return new CompiledFunction(code, pcode_start_, edges.take(), cipmap.take());
+  return new CompiledFunction(code, pcode_start_, edges.take(), cipmap.take(),
+                              break_sites.take(), debug_break_.offset());
 }
 
 void
@@ -74,6 +74,7 @@ class CompilerBase : public PcodeVisitor
   virtual void emitErrorHandlers() = 0;
   virtual void emitOutOfBoundsErrorPath(OutOfBoundsErrorPath* path) = 0;
   virtual void emitDebugBreakHandler() = 0;
+  virtual void emitDataWatchHandler() = 0;
 
   // Helpers.
   static int CompileFromThunk(PluginContext* cx, cell_t pcode_offs, void** addrp, uint8_t* pc);
@@ -134,9 +135,11 @@ class CompilerBase : public PcodeVisitor
 
   // Debugging.
   Label debug_break_;
+  Label data_watch_;
 
   ke::Vector<BackwardJump> backward_jumps_;
   ke::Vector<CipMapEntry> cip_map_;
+  ke::Vector<BreakSite> break_sites_;
 };
 
 } // namespace sp
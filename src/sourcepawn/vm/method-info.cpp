@@ -40,6 +40,7 @@ MethodInfo::setCompiledFunction(CompiledFunction* fun)
   // at this on another thread.
   ke::AutoLock lock(Environment::get()->lock());
   jit_ = fun;
+  rt_->AddBreakSites(fun);
 }
 
 void
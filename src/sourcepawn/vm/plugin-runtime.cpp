@@ -30,6 +30,12 @@ using namespace SourcePawn;
 PluginRuntime::PluginRuntime(LegacyImage* image)
  : image_(image),
    paused_(false),
+   all_debug_breaks_armed_(false),
+   context_slot_(0),
+   watch_lo_(0),
+   watch_hi_(0),
+   watch_hit_addr_(0),
+   watch_hit_size_(0),
    computed_code_hash_(false),
    computed_data_hash_(false)
 {
@@ -56,6 +62,26 @@ PluginRuntime::~PluginRuntime()
     delete entrypoints_[i];
 }
 
+void
+PluginRuntime::AddBreakSites(CompiledFunction* fun)
+{
+  for (uint32_t i = 0; i < fun->NumBreakSites(); i++) {
+    ucell_t cip = fun->GetCodeOffset() + fun->GetBreakSite(i).cipoffs;
+    break_site_index_[cip] = std::make_pair(fun, i);
+  }
+}
+
+void
+PluginRuntime::PatchBreakSite(ucell_t cip)
+{
+  // Functions that have not been compiled yet pick up the armed state when
+  // the JIT reaches their BREAK opcodes.
+  auto found = break_site_index_.find(cip);
+  if (found == break_site_index_.end())
+    return;
+  found->second.first->PatchBreakSite(found->second.second, IsDebugBreakArmed(cip));
+}
+
 bool
 PluginRuntime::Initialize()
 {
@@ -21,12 +21,16 @@
 #include <amtl/am-refcounting.h>
 #include "scripted-invoker.h"
 #include "legacy-image.h"
+#include "bitset.h"
+#include <unordered_map>
+#include <utility>
 namespace sp {
 
 using namespace ke;
 
 class PluginContext;
 class MethodInfo;
+class CompiledFunction;
 
 struct floattbl_t
 {
@@ -115,6 +119,60 @@ class PluginRuntime
 
   PluginContext* GetBaseContext();
 
+  // Patchable debug break state; see Environment::EnablePatchableDebugBreak.
+  bool IsDebugBreakArmed(ucell_t cip) {
+    return all_debug_breaks_armed_ || debug_breaks_.test(cip / sizeof(cell_t));
+  }
+  void SetDebugBreakArmed(ucell_t cip, bool armed) {
+    if (armed)
+      debug_breaks_.set(cip / sizeof(cell_t));
+    else
+      debug_breaks_.clear(cip / sizeof(cell_t));
+  }
+  void SetAllDebugBreaksArmed(bool armed) {
+    all_debug_breaks_armed_ = armed;
+  }
+
+  // Indexes the BREAK sites of a newly compiled function by cip, so a
+  // single site can be patched without scanning every method. The caller
+  // must own the environment lock.
+  void AddBreakSites(CompiledFunction* fun);
+
+  // Brings the compiled site at cip, if any, in line with its armed state.
+  // The caller must own the environment lock.
+  void PatchBreakSite(ucell_t cip);
+
+  // Dense index for debugger side tables, reused once the runtime is gone.
+  uint32_t context_slot() const {
+    return context_slot_;
+  }
+  void set_context_slot(uint32_t slot) {
+    context_slot_ = slot;
+  }
+
+  // Data watchpoint state; see Environment::EnableDataWatchpoints. The
+  // range is [lo, hi), and an empty range never matches.
+  bool IsDataWatched(ucell_t addr, ucell_t size) const {
+    return addr < watch_hi_ && addr + size > watch_lo_;
+  }
+  void SetDataWatchRange(ucell_t addr, ucell_t size) {
+    watch_lo_ = size ? addr : 0;
+    watch_hi_ = size ? addr + size : 0;
+  }
+  void* addressOfWatchLo() {
+    return &watch_lo_;
+  }
+  void* addressOfWatchHi() {
+    return &watch_hi_;
+  }
+  // Compiled stores leave the hit here for the data watch thunk.
+  void* addressOfWatchHitAddr() {
+    return &watch_hit_addr_;
+  }
+  void* addressOfWatchHitSize() {
+    return &watch_hit_size_;
+  }
+
   const char* Name() const {
     return name_.c_str();
   }
@@ -173,6 +231,19 @@ class PluginRuntime
   // Pause state.
   bool paused_;
 
+  // Armed BREAK sites, indexed by cell.
+  BitSet debug_breaks_;
+  bool all_debug_breaks_armed_;
+  std::unordered_map<ucell_t, std::pair<CompiledFunction*, uint32_t>> break_site_index_;
+
+  uint32_t context_slot_;
+
+  // Watched data range and the last store that hit it.
+  ucell_t watch_lo_;
+  ucell_t watch_hi_;
+  cell_t watch_hit_addr_;
+  cell_t watch_hit_size_;
+
   // Checksumming.
   bool computed_code_hash_;
   bool computed_data_hash_;
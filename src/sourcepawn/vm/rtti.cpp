@@ -25,6 +25,21 @@ RttiData::RttiData(const uint8_t* blob, uint32_t size)
 {
 }
 
+template <typename Decoder>
+const Rtti*
+RttiData::intern(TypeCache& cache, uint32_t key, Decoder decode) const
+{
+  std::lock_guard<std::mutex> lock(cache_lock_);
+  auto iter = cache.find(key);
+  if (iter != cache.end())
+    return iter->second.get();
+
+  // Failed decodes are cached too, as null.
+  const Rtti* type = decode();
+  cache.emplace(key, std::unique_ptr<const Rtti>(type));
+  return type;
+}
+
 const Rtti*
 RttiData::typeFromTypeId(uint32_t type_id) const
 {
@@ -35,17 +50,21 @@ RttiData::typeFromTypeId(uint32_t type_id) const
   uint32_t payload = (type_id >> 4) & kMaxTypeIdPayload;
 
   if (kind == kTypeId_Inline) {
-    uint8_t bytes[4];
-    bytes[0] = (payload >> 0) & 0xff;
-    bytes[1] = (payload >> 8) & 0xff;
-    bytes[2] = (payload >> 16) & 0xff;
-    bytes[3] = (payload >> 24) & 0xff;
-
-    RttiParser parser(bytes, 4, 0);
-    return parser.decodeNew();
+    return intern(types_, type_id, [payload]() -> const Rtti* {
+      uint8_t bytes[4];
+      bytes[0] = (payload >> 0) & 0xff;
+      bytes[1] = (payload >> 8) & 0xff;
+      bytes[2] = (payload >> 16) & 0xff;
+      bytes[3] = (payload >> 24) & 0xff;
+
+      RttiParser parser(bytes, 4, 0);
+      return parser.decodeNew();
+    });
   } else if (kind == kTypeId_Complex) {
-    RttiParser parser(rtti_data_, rtti_data_size_, payload);
-    return parser.decodeNew();
+    return intern(types_, type_id, [this, payload]() -> const Rtti* {
+      RttiParser parser(rtti_data_, rtti_data_size_, payload);
+      return parser.decodeNew();
+    });
   }
   return nullptr;
 }
@@ -56,8 +75,10 @@ RttiData::functionTypeFromOffset(uint32_t offset) const
   if (!rtti_data_)
     return nullptr;
 
-  RttiParser parser(rtti_data_, rtti_data_size_, offset);
-  return parser.decodeFunction();
+  return intern(functions_, offset, [this, offset]() -> const Rtti* {
+    RttiParser parser(rtti_data_, rtti_data_size_, offset);
+    return parser.decodeFunction();
+  });
 }
 
 const Rtti*
@@ -66,8 +87,10 @@ RttiData::typesetTypeFromOffset(uint32_t offset) const
   if (!rtti_data_)
     return nullptr;
 
-  RttiParser parser(rtti_data_, rtti_data_size_, offset);
-  return parser.decodeTypeset();
+  return intern(typesets_, offset, [this, offset]() -> const Rtti* {
+    RttiParser parser(rtti_data_, rtti_data_size_, offset);
+    return parser.decodeTypeset();
+  });
 }
 
 const uint8_t*
@@ -11,6 +11,8 @@
 #define _include_sourcepawn_rtti_h_
 
 #include <memory>
+#include <mutex>
+#include <unordered_map>
 #include <vector>
 
 #include <sp_vm_types.h>
@@ -26,6 +28,8 @@ public:
   RttiData();
   RttiData(const uint8_t* blob, uint32_t size);
 
+  // Decoded types are interned and owned by the RttiData, so repeated
+  // lookups of the same id or offset return the same tree.
   const Rtti* typeFromTypeId(uint32_t type_id) const;
   const Rtti* functionTypeFromOffset(uint32_t offset) const;
   const Rtti* typesetTypeFromOffset(uint32_t offset) const;
@@ -37,9 +41,20 @@ public:
   bool validateFunctionOffset(uint32_t offset) const;
   bool validateTypesetOffset(uint32_t offset) const;
 
+private:
+  typedef std::unordered_map<uint32_t, std::unique_ptr<const Rtti>> TypeCache;
+
+  template <typename Decoder>
+  const Rtti* intern(TypeCache& cache, uint32_t key, Decoder decode) const;
+
 private:
   const uint8_t* rtti_data_;
   uint32_t rtti_data_size_;
+
+  mutable std::mutex cache_lock_;
+  mutable TypeCache types_;
+  mutable TypeCache functions_;
+  mutable TypeCache typesets_;
 };
 
 class RttiParser {
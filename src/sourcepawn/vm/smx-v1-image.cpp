@@ -9,14 +9,52 @@
 //
 #include "smx-v1-image.h"
 #include <zlib.h>
+#include <algorithm>
 #include <fmt/format.h>
+#include <sys/stat.h>
+#if defined(_WIN32)
+# ifndef NOMINMAX
+#  define NOMINMAX
+# endif
+# include <windows.h>
+# include <io.h>
+#endif
 
 using namespace ke;
 using namespace sp;
 
-SmxV1Image::SmxV1Image(FILE* fp)
- : FileReader(fp)
+static std::string sDecompressedCacheDir;
+static bool sMapPluginFiles = false;
+
+static const uint32_t kCacheKeyMagic = 0x4b534d53; // "SMSK"
+
+// Modification time of an open file in the platform's finest unit, or 0
+// if unknown.
+static int64_t
+FileModificationTime(FILE* fp) {
+#if defined(_WIN32)
+    FILETIME written;
+    HANDLE file = (HANDLE)_get_osfhandle(_fileno(fp));
+    if (file == INVALID_HANDLE_VALUE || !GetFileTime(file, nullptr, nullptr, &written))
+        return 0;
+    return (int64_t(written.dwHighDateTime) << 32) | written.dwLowDateTime;
+#else
+    struct stat st;
+    if (fstat(fileno(fp), &st) != 0)
+        return 0;
+# if defined(__APPLE__)
+    return int64_t(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+# else
+    return int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+# endif
+#endif
+}
+
+SmxV1Image::SmxV1Image(FILE* fp, const char* path)
+ : FileReader(fp, sMapPluginFiles)
  , hdr_(nullptr)
+ , source_path_(path ? path : "")
+ , source_mtime_(path ? FileModificationTime(fp) : 0)
  , header_strings_(nullptr)
  , names_section_(nullptr)
  , names_(nullptr)
@@ -29,7 +67,7 @@ SmxV1Image::SmxV1Image(FILE* fp)
 // Validating SMX v1 scripts is fairly expensive. We reserve real validation
 // for v2.
 bool
-SmxV1Image::validate() {
+SmxV1Image::validate(Validation mode) {
     if (length_ < sizeof(sp_file_hdr_t))
         return error("bad header");
 
@@ -66,6 +104,20 @@ SmxV1Image::validate() {
             if (hdr_->imagesize < hdr_->dataoffs)
                 return error("illegal image size");
 
+            // A previous load may have left the inflated image behind.
+            std::string cache_path = decompressedCachePath();
+            if (!cache_path.empty() && loadDecompressedCache(cache_path))
+                break;
+
+            // Keyed before the compressed image is replaced.
+            CacheKey key = {};
+            if (!cache_path.empty()) {
+                key.magic = kCacheKeyMagic;
+                key.source_size = (uint32_t)length_;
+                key.source_crc = sourceChecksum();
+                key.source_mtime = source_mtime_;
+            }
+
             // Allocate the uncompressed image buffer.
             uint32_t compressedSize = hdr_->disksize - hdr_->dataoffs;
             std::unique_ptr<uint8_t[]> uncompressed = std::make_unique<uint8_t[]>(hdr_->imagesize);
@@ -84,9 +136,11 @@ SmxV1Image::validate() {
             memcpy(uncompressed.get(), buffer(), hdr_->dataoffs);
 
             // Replace the original buffer.
-            length_ = hdr_->imagesize;
-            buffer_ = std::move(uncompressed);
+            reset(std::move(uncompressed), hdr_->imagesize);
             hdr_ = (sp_file_hdr_t*)buffer();
+
+            if (!cache_path.empty())
+                storeDecompressedCache(cache_path, key);
             break;
         }
 
@@ -150,22 +204,138 @@ SmxV1Image::validate() {
         return false;
     if (!validateData())
         return false;
-    if (!validatePublics())
-        return false;
-    if (!validatePubvars())
-        return false;
-    if (!validateNatives())
-        return false;
-    if (!validateRtti())
-        return false;
-    if (!validateDebugInfo())
+
+    if (mode == Validation::Lazy)
+        return true;
+    for (int group = 0; group < kGroupCount; group++) {
+        if (!ensure(LazyGroup(group)))
+            return false;
+    }
+    return true;
+}
+
+bool
+SmxV1Image::ensure(LazyGroup group) const {
+    SmxV1Image* self = const_cast<SmxV1Image*>(this);
+    std::call_once(group_once_[group], [self, group]() {
+        self->group_ok_[group] = self->validateGroup(group);
+    });
+    return group_ok_[group];
+}
+
+bool
+SmxV1Image::validateGroup(LazyGroup group) {
+    switch (group) {
+        case kGroupTables:
+            return validatePublics() && validatePubvars() && validateNatives();
+        case kGroupRtti:
+            return validateRtti();
+        case kGroupDebugInfo:
+            return validateDebugInfo();
+        case kGroupTags:
+            return validateTags();
+        case kGroupSymbols:
+            if (!ensure(kGroupDebugInfo))
+                return false;
+            buildSymbolIndex();
+            return true;
+        default:
+            return false;
+    }
+}
+
+void
+SmxV1Image::SetDecompressedCacheDir(const char* path) {
+    sDecompressedCacheDir = path ? path : "";
+}
+
+void
+SmxV1Image::SetMapPluginFiles(bool map) {
+    sMapPluginFiles = map;
+}
+
+// Cached images are named after the plugin's path, so each plugin has one
+// cache file that a recompile overwrites instead of adding another.
+std::string
+SmxV1Image::decompressedCachePath() const {
+    if (sDecompressedCacheDir.empty() || source_path_.empty())
+        return std::string();
+    size_t slash = source_path_.find_last_of("/\\");
+    std::string name = source_path_.substr(slash == std::string::npos ? 0 : slash + 1);
+    size_t dot = name.rfind('.');
+    if (dot != std::string::npos)
+        name.erase(dot);
+    uLong crc = crc32(0L, Z_NULL, 0);
+    crc = crc32(crc, reinterpret_cast<const Bytef*>(source_path_.data()),
+                (uInt)source_path_.size());
+    return fmt::format("{}/{}-{:08x}.smx", sDecompressedCacheDir, name, (uint32_t)crc);
+}
+
+// Checksum of the file as loaded, before it is inflated.
+uint32_t
+SmxV1Image::sourceChecksum() const {
+    uLong crc = crc32(0L, Z_NULL, 0);
+    return (uint32_t)crc32(crc, buffer(), (uInt)length_);
+}
+
+bool
+SmxV1Image::loadDecompressedCache(const std::string& path) {
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (!fp)
         return false;
-    if (!validateTags())
+
+    uint32_t imagesize = hdr_->imagesize;
+    uint32_t dataoffs = hdr_->dataoffs;
+    sp_file_hdr_t cached;
+    CacheKey key;
+    bool ok = fread(&cached, sizeof(cached), 1, fp) == 1 &&
+              cached.magic == hdr_->magic &&
+              cached.version == hdr_->version &&
+              cached.compression == SmxConsts::FILE_COMPRESSION_NONE &&
+              cached.imagesize == imagesize &&
+              cached.dataoffs == dataoffs &&
+              fseek(fp, 0, SEEK_END) == 0 &&
+              ftell(fp) == (long)(imagesize + sizeof(key)) &&
+              fseek(fp, imagesize, SEEK_SET) == 0 &&
+              fread(&key, sizeof(key), 1, fp) == 1 &&
+              key.magic == kCacheKeyMagic &&
+              key.source_size == length_ &&
+              ((source_mtime_ && key.source_mtime == source_mtime_) ||
+               key.source_crc == sourceChecksum()) &&
+              map(fp, imagesize);
+    fclose(fp);
+    if (!ok)
         return false;
 
+    hdr_ = (sp_file_hdr_t*)buffer();
     return true;
 }
 
+void
+SmxV1Image::storeDecompressedCache(const std::string& path, const CacheKey& key) const {
+    // Written under a temporary name and renamed over the plugin's previous
+    // copy, so a concurrent load never maps a partial file and images that
+    // still map the old copy keep their pages.
+    std::string temp = path + ".tmp";
+    FILE* fp = fopen(temp.c_str(), "wb");
+    if (!fp)
+        return;
+
+    sp_file_hdr_t hdr = *hdr_;
+    hdr.compression = SmxConsts::FILE_COMPRESSION_NONE;
+    hdr.disksize = hdr.imagesize;
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1 &&
+              fwrite(buffer() + sizeof(hdr), length_ - sizeof(hdr), 1, fp) == 1 &&
+              fwrite(&key, sizeof(key), 1, fp) == 1;
+    if (fclose(fp) != 0)
+        ok = false;
+    // rename does not replace an existing file on Windows.
+    if (ok && rename(temp.c_str(), path.c_str()) != 0)
+        ok = remove(path.c_str()) == 0 && rename(temp.c_str(), path.c_str()) == 0;
+    if (!ok)
+        remove(temp.c_str());
+}
+
 const SmxV1Image::Section*
 SmxV1Image::findSection(const char* name) {
     for (size_t i = 0; i < sections_.size(); i++) {
@@ -510,6 +680,9 @@ SmxV1Image::validateTags() {
 
 SmxV1Image::SymbolIterator
 SmxV1Image::symboliterator(bool global) {
+    // Without valid debug info there is nothing to iterate.
+    if (!ensure(kGroupDebugInfo))
+        return SymbolIterator(nullptr, 0, 1, this);
     if (debug_syms_) {
         SymbolIterator iter((uint8_t*)debug_syms_, debug_symbols_section_->size, 1, this);
         return iter;
@@ -518,6 +691,8 @@ SmxV1Image::symboliterator(bool global) {
         SymbolIterator iter((uint8_t*)debug_syms_unpacked_, debug_symbols_section_->size, 0, this);
         return iter;
     }
+    if (!(global ? globals_ : locals_))
+        return SymbolIterator(nullptr, 0, 1, this);
     if (!global) {
         const smx_rtti_debug_var* variable = getRttiRow<smx_rtti_debug_var>(locals_, 0);
         SymbolIterator iter((uint8_t*)variable, locals_->row_size * sizeof(smx_rtti_debug_var), 2,
@@ -550,17 +725,23 @@ SmxV1Image::DescribeData() const -> LegacyImage::Data {
 
 size_t
 SmxV1Image::NumNatives() const {
+    if (!ensure(kGroupTables))
+        return 0;
     return natives_.length();
 }
 
 const char*
 SmxV1Image::GetNative(size_t index) const {
+    if (!ensure(kGroupTables))
+        return nullptr;
     assert(index < natives_.length());
     return names_ + natives_[index].name;
 }
 
 bool
 SmxV1Image::FindNative(const char* name, size_t* indexp) const {
+    if (!ensure(kGroupTables))
+        return false;
     for (size_t i = 0; i < natives_.length(); i++) {
         const char* candidate = names_ + natives_[i].name;
         if (strcmp(candidate, name) == 0) {
@@ -574,11 +755,15 @@ SmxV1Image::FindNative(const char* name, size_t* indexp) const {
 
 size_t
 SmxV1Image::NumPublics() const {
+    if (!ensure(kGroupTables))
+        return 0;
     return publics_.length();
 }
 
 void
 SmxV1Image::GetPublic(size_t index, uint32_t* offsetp, const char** namep) const {
+    if (!ensure(kGroupTables))
+        return;
     assert(index < publics_.length());
     if (offsetp)
         *offsetp = publics_[index].address;
@@ -588,6 +773,8 @@ SmxV1Image::GetPublic(size_t index, uint32_t* offsetp, const char** namep) const
 
 bool
 SmxV1Image::FindPublic(const char* name, size_t* indexp) const {
+    if (!ensure(kGroupTables))
+        return false;
     int high = publics_.length() - 1;
     int low = 0;
     while (low <= high) {
@@ -610,11 +797,15 @@ SmxV1Image::FindPublic(const char* name, size_t* indexp) const {
 
 size_t
 SmxV1Image::NumPubvars() const {
+    if (!ensure(kGroupTables))
+        return 0;
     return pubvars_.length();
 }
 
 void
 SmxV1Image::GetPubvar(size_t index, uint32_t* offsetp, const char** namep) const {
+    if (!ensure(kGroupTables))
+        return;
     assert(index < pubvars_.length());
     if (offsetp)
         *offsetp = pubvars_[index].address;
@@ -624,6 +815,8 @@ SmxV1Image::GetPubvar(size_t index, uint32_t* offsetp, const char** namep) const
 
 bool
 SmxV1Image::FindPubvar(const char* name, size_t* indexp) const {
+    if (!ensure(kGroupTables))
+        return false;
     int high = pubvars_.length() - 1;
     int low = 0;
     while (low <= high) {
@@ -656,6 +849,8 @@ SmxV1Image::ImageSize() const {
 
 const char*
 SmxV1Image::LookupFile(uint32_t addr) {
+    if (!ensure(kGroupDebugInfo))
+        return nullptr;
     int high = debug_files_.length();
     int low = -1;
 
@@ -698,8 +893,59 @@ SmxV1Image::lookupFunction(const SymbolType* syms, uint32_t addr) {
     return nullptr;
 }
 
+template <typename SymbolType, typename DimType>
+bool
+SmxV1Image::lookupFunctionRange(const SymbolType* syms, uint32_t addr, uint32_t* start,
+                                uint32_t* end) {
+    const uint8_t* cursor = reinterpret_cast<const uint8_t*>(syms);
+    const uint8_t* cursor_end = cursor + debug_symbols_section_->size;
+    for (uint32_t i = 0; i < debug_info_->num_syms; i++) {
+        if (cursor + sizeof(SymbolType) > cursor_end)
+            break;
+
+        const SymbolType* sym = reinterpret_cast<const SymbolType*>(cursor);
+        if (sym->ident == sp::IDENT_FUNCTION && sym->codestart <= addr && sym->codeend > addr) {
+            *start = sym->codestart;
+            *end = sym->codeend;
+            return true;
+        }
+
+        if (sym->dimcount > 0)
+            cursor += sizeof(DimType) * sym->dimcount;
+        cursor += sizeof(SymbolType);
+    }
+    return false;
+}
+
+// Finds the code range of the function containing addr, from rtti.methods
+// or, in older plugins, from the function symbols.
+bool
+SmxV1Image::findFunctionRange(uint32_t addr, uint32_t* start, uint32_t* end) {
+    if (ensure(kGroupRtti) && rtti_methods_) {
+        for (uint32_t i = 0; i < rtti_methods_->row_count; i++) {
+            const smx_rtti_method* method = getRttiRow<smx_rtti_method>(rtti_methods_, i);
+            if (method->pcode_start <= addr && method->pcode_end > addr) {
+                *start = method->pcode_start;
+                *end = method->pcode_end;
+                return true;
+            }
+        }
+    }
+    if (debug_syms_) {
+        return lookupFunctionRange<sp_fdbg_symbol_t, sp_fdbg_arraydim_t>(debug_syms_, addr,
+                                                                         start, end);
+    }
+    if (debug_syms_unpacked_) {
+        return lookupFunctionRange<sp_u_fdbg_symbol_t, sp_u_fdbg_arraydim_t>(
+            debug_syms_unpacked_, addr, start, end);
+    }
+    return false;
+}
+
 const char*
 SmxV1Image::LookupFunction(uint32_t code_offset) {
+    if (!ensure(kGroupDebugInfo))
+        return nullptr;
     if (debug_syms_) {
         return lookupFunction<sp_fdbg_symbol_t, sp_fdbg_arraydim_t>(debug_syms_, code_offset);
     }
@@ -709,6 +955,8 @@ SmxV1Image::LookupFunction(uint32_t code_offset) {
 
 bool
 SmxV1Image::LookupLine(uint32_t addr, uint32_t* line) {
+    if (!ensure(kGroupDebugInfo))
+        return false;
     int high = debug_lines_.length();
     int low = -1;
 
@@ -752,6 +1000,8 @@ SmxV1Image::getFunctionAddress(const SymbolType* syms, const char* name, uint32_
 
 bool
 SmxV1Image::GetFunctionAddress(const char* function, const char* file, uint32_t* funcaddr) {
+    if (!ensure(kGroupDebugInfo))
+        return false;
     uint32_t index = 0;
     const char* tgtfile;
     *funcaddr = 0;
@@ -789,6 +1039,8 @@ SmxV1Image::GetFunctionAddress(const char* function, const char* file, uint32_t*
 
 bool
 SmxV1Image::GetLineAddress(const uint32_t line, const char* filename, uint32_t* addr) {
+    if (!ensure(kGroupDebugInfo))
+        return false;
     /* Find a suitable "breakpoint address" close to the indicated line (and in
    * the specified file). The address is moved up to the next "breakable" line
    * if no "breakpoint" is available on the specified line. You can use function
@@ -838,8 +1090,39 @@ SmxV1Image::GetLineAddress(const uint32_t line, const char* filename, uint32_t*
     return true;
 }
 
+// Appends the address of every line (BREAK) of the function containing
+// code_offset, in ascending order, with one pass over the line table.
+bool
+SmxV1Image::GetFunctionLineAddresses(uint32_t code_offset, std::vector<uint32_t>* addrs) {
+    if (!ensure(kGroupDebugInfo))
+        return false;
+    uint32_t codestart, codeend;
+    if (!findFunctionRange(code_offset, &codestart, &codeend))
+        return false;
+
+    // find the first line at or after the start of the function
+    int high = debug_lines_.length();
+    int low = -1;
+    while (high - low > 1) {
+        int mid = (low + high) / 2;
+        if (debug_lines_[mid].addr < codestart)
+            low = mid;
+        else
+            high = mid;
+    }
+
+    size_t count = addrs->size();
+    for (size_t index = high; index < debug_lines_.length() && debug_lines_[index].addr < codeend;
+         index++) {
+        addrs->push_back(debug_lines_[index].addr);
+    }
+    return addrs->size() > count;
+}
+
 const char*
 SmxV1Image::FindFileByPartialName(const char* partialname) {
+    if (!ensure(kGroupDebugInfo))
+        return nullptr;
     // the user may have given a partial filename (e.g. without a path), so
     // walk through all files to find a match.
     int len = strlen(partialname);
@@ -861,6 +1144,8 @@ SmxV1Image::FindFileByPartialName(const char* partialname) {
 
 const char*
 SmxV1Image::GetTagName(uint32_t tag) {
+    if (!ensure(kGroupTags))
+        return nullptr;
     unsigned int index;
     for (index = 0; index < tags_.length() && tags_[index].tag_id != tag; index++)
         /* nothing */;
@@ -872,41 +1157,181 @@ SmxV1Image::GetTagName(uint32_t tag) {
 
 bool
 SmxV1Image::GetVariable(const char* symname, uint32_t scopeaddr, std::unique_ptr<Symbol>& sym) {
-    uint32_t codestart = 0;
-    uint32_t codeend = 0;
+    Symbol* found = FindVariable(symname, scopeaddr);
+    sym = found ? std::make_unique<Symbol>(*found) : nullptr;
+    return sym != nullptr;
+}
+
+void
+SmxV1Image::buildSymbolIndex() {
+    symbols_.clear();
+    local_scopes_.clear();
+    local_scopes_level_ = -1;
+    global_symbols_.clear();
+    symbol_names_.clear();
+
+    if (!debug_names_)
+        return;
+
+    std::vector<uint32_t> locals;
+    if (debug_syms_ || debug_syms_unpacked_) {
+        // Legacy tables don't split locals from globals, so every symbol is
+        // searched by scope first and by name alone afterwards.
+        SymbolIterator iter = symboliterator();
+        while (!iter.Done()) {
+            std::unique_ptr<Symbol> sym(iter.Next());
+            locals.push_back(symbols_.size());
+            global_symbols_.push_back(symbols_.size());
+            symbols_.push_back(*sym);
+        }
+    } else {
+        if (locals_) {
+            for (uint32_t i = 0; i < locals_->row_count; i++) {
+                auto row = getRttiRow<smx_rtti_debug_var>(locals_, i);
+                locals.push_back(symbols_.size());
+                symbols_.emplace_back(const_cast<smx_rtti_debug_var*>(row), this);
+            }
+        }
+        if (globals_) {
+            for (uint32_t i = 0; i < globals_->row_count; i++) {
+                auto row = getRttiRow<smx_rtti_debug_var>(globals_, i);
+                global_symbols_.push_back(symbols_.size());
+                symbols_.emplace_back(const_cast<smx_rtti_debug_var*>(row), this);
+            }
+        }
+    }
 
-    sym = nullptr;
+    std::stable_sort(locals.begin(), locals.end(), [this](uint32_t a, uint32_t b) {
+        return symbols_[a].codestart() < symbols_[b].codestart();
+    });
+    local_scopes_.reserve(locals.size());
+    for (uint32_t index : locals) {
+        const Symbol& sym = symbols_[index];
+        local_scopes_.push_back({ sym.codestart(), sym.codeend(), sym.codeend(), index });
+    }
+    local_scopes_level_ = indexLocalScopes();
 
-    SymbolIterator iter = symboliterator(false);
-    while (!iter.Done()) {
-        // find (next) matching variable
-        sym = std::make_unique<Symbol>(iter.Next());
+    for (uint32_t i = 0; i < local_scopes_.size(); i++) {
+        if (const char* name = GetDebugName(symbols_[local_scopes_[i].symbol].name()))
+            symbol_names_[name].locals.push_back(i);
+    }
+    for (uint32_t index : global_symbols_) {
+        if (const char* name = GetDebugName(symbols_[index].name())) {
+            SymbolName& entry = symbol_names_[name];
+            if (entry.global < 0)
+                entry.global = index;
+        }
+    }
+}
 
-        if (sym->codestart() <= scopeaddr && sym->codeend() >= scopeaddr &&              
-            strcmp(debug_names_ + sym->name(), symname) == 0) {            
-            break;
+// Fills in maxend bottom-up and returns the level of the root.
+int
+SmxV1Image::indexLocalScopes() {
+    size_t count = local_scopes_.size();
+    if (!count)
+        return -1;
+
+    // Leaves are the even nodes. |last_node| tracks the rightmost node of
+    // the current level, which stands in for right children past the end.
+    size_t last_node = 0;
+    uint32_t last_max = 0;
+    for (size_t i = 0; i < count; i += 2) {
+        last_node = i;
+        last_max = local_scopes_[i].maxend = local_scopes_[i].codeend;
+    }
+
+    int level = 1;
+    for (; (size_t(1) << level) <= count; level++) {
+        size_t half = size_t(1) << (level - 1);
+        for (size_t i = (half << 1) - 1; i < count; i += half << 2) {
+            uint32_t left = local_scopes_[i - half].maxend;
+            uint32_t right = i + half < count ? local_scopes_[i + half].maxend : last_max;
+            local_scopes_[i].maxend = std::max(local_scopes_[i].codeend, std::max(left, right));
         }
-        sym = nullptr;
+        last_node = ((last_node >> level) & 1) ? last_node - half : last_node + half;
+        if (last_node < count && local_scopes_[last_node].maxend > last_max)
+            last_max = local_scopes_[last_node].maxend;
     }
-    if (sym == nullptr) {
-        iter = symboliterator(true);
-        while (!iter.Done()) {
-            // find (next) matching variable
-            sym = std::make_unique<Symbol>(iter.Next());
+    return level - 1;
+}
 
-            if (
-                strcmp(debug_names_ + sym->name(), symname) == 0) {
-                break;
+SmxV1Image::Symbol*
+SmxV1Image::FindVariable(const char* symname, uint32_t scopeaddr) {
+    if (!ensure(kGroupSymbols))
+        return nullptr;
+    auto found = symbol_names_.find(symname);
+    if (found == symbol_names_.end())
+        return nullptr;
+
+    // Prefer the innermost scope: walk back from the last local that starts
+    // at or before the address.
+    const SymbolName& entry = found->second;
+    auto iter = std::upper_bound(entry.locals.begin(), entry.locals.end(), scopeaddr,
+                                 [this](uint32_t addr, uint32_t node) {
+                                     return addr < local_scopes_[node].codestart;
+                                 });
+    while (iter != entry.locals.begin()) {
+        const ScopeNode& node = local_scopes_[*--iter];
+        if (node.codeend >= scopeaddr)
+            return &symbols_[node.symbol];
+    }
+    if (entry.global >= 0)
+        return &symbols_[entry.global];
+    return nullptr;
+}
+
+void
+SmxV1Image::ForEachLocalSymbol(uint32_t scopeaddr, const std::function<void(Symbol*)>& callback) {
+    if (!ensure(kGroupSymbols))
+        return;
+    if (local_scopes_.empty())
+        return;
+
+    struct Frame {
+        int level;
+        size_t node;
+        bool left_done;
+    };
+    Frame stack[64];
+    size_t depth = 0;
+    size_t count = local_scopes_.size();
+
+    stack[depth++] = { local_scopes_level_, (size_t(1) << local_scopes_level_) - 1, false };
+    while (depth) {
+        Frame frame = stack[--depth];
+        if (frame.level <= 3) {
+            // Small subtrees are cheaper to scan in order.
+            size_t first = frame.node >> frame.level << frame.level;
+            size_t last = std::min(first + (size_t(1) << (frame.level + 1)) - 1, count);
+            for (size_t i = first; i < last && local_scopes_[i].codestart <= scopeaddr; i++) {
+                if (local_scopes_[i].codeend >= scopeaddr)
+                    callback(&symbols_[local_scopes_[i].symbol]);
             }
-            sym = nullptr;
+        } else if (!frame.left_done) {
+            size_t left = frame.node - (size_t(1) << (frame.level - 1));
+            stack[depth++] = { frame.level, frame.node, true };
+            if (left >= count || local_scopes_[left].maxend >= scopeaddr)
+                stack[depth++] = { frame.level - 1, left, false };
+        } else if (frame.node < count && local_scopes_[frame.node].codestart <= scopeaddr) {
+            if (local_scopes_[frame.node].codeend >= scopeaddr)
+                callback(&symbols_[local_scopes_[frame.node].symbol]);
+            stack[depth++] = { frame.level - 1, frame.node + (size_t(1) << (frame.level - 1)), false };
         }
-
     }
-    return sym != nullptr;
+}
+
+void
+SmxV1Image::ForEachGlobalSymbol(const std::function<void(Symbol*)>& callback) {
+    if (!ensure(kGroupSymbols))
+        return;
+    for (uint32_t index : global_symbols_)
+        callback(&symbols_[index]);
 }
 
 const char*
 SmxV1Image::GetDebugName(uint32_t nameoffs) {
+    if (!ensure(kGroupDebugInfo))
+        return nullptr;
     if (nameoffs >= debug_names_section_->size)
         return nullptr;
     return debug_names_ + nameoffs;
@@ -914,6 +1339,8 @@ SmxV1Image::GetDebugName(uint32_t nameoffs) {
 
 const char*
 SmxV1Image::GetFileName(uint32_t index) {
+    if (!ensure(kGroupDebugInfo))
+        return nullptr;
     if (debug_files_[index].name >= debug_names_section_->size)
         return nullptr;
     return debug_names_ + debug_files_[index].name;
@@ -921,11 +1348,15 @@ SmxV1Image::GetFileName(uint32_t index) {
 
 uint32_t
 SmxV1Image::GetFileCount() {
+    if (!ensure(kGroupDebugInfo))
+        return 0;
     return debug_info_->num_files;
 }
 
 std::vector<SmxV1Image::ArrayDim*>*
 SmxV1Image::GetArrayDimensions(const Symbol* sym) {
+    if (!ensure(kGroupDebugInfo))
+        return nullptr;
     if (sym->ident() != sp::IDENT_ARRAY && sym->ident() != IDENT_REFARRAY)
         return nullptr;
 
@@ -1046,6 +1477,8 @@ size_t SmxV1Image::getTypeFromTypeId(uint32_t typeId) {
 };
 std::vector<smx_rtti_es_field*>
 SmxV1Image::getEnumFields(uint32_t index) {
+    if (!ensure(kGroupRtti))
+        return {};
     const smx_rtti_enumstruct* enumstruct = getRttiRow<smx_rtti_enumstruct>(rtti_enumstructs_, index);
     // Calculate how many fields this class has.
     uint32_t stopat = rtti_enumstruct_fields_->row_count;
@@ -1070,6 +1503,8 @@ SmxV1Image::getEnumFields(uint32_t index) {
 
 std::vector<smx_rtti_field*>
 SmxV1Image::getTypeFields(uint32_t index) {
+    if (!ensure(kGroupRtti))
+        return {};
     const smx_rtti_classdef* classdef = getRttiRow<smx_rtti_classdef>(rtti_classdefs_, index);
     // Calculate how many fields this class has.
     uint32_t stopat = rtti_fields_->row_count;
@@ -20,6 +20,9 @@
 #include "smx/smx-legacy-debuginfo.h"
 #include "smx/smx-typeinfo.h"
 #include <functional>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
 #include "rtti.h"
 namespace sp {
 
@@ -32,10 +35,27 @@ class SmxV1Image : public FileReader
     };
 
   public:
-    SmxV1Image(FILE* fp);
-
-    // This must be called to initialize the reader.
-    bool validate();
+    // path names the file for the decompressed image cache; without it the
+    // cache is not used.
+    SmxV1Image(FILE* fp, const char* path = nullptr);
+
+    // This must be called to initialize the reader. Lazy validation only
+    // checks the header, the section table, code and data; every other
+    // group of sections is validated the first time an accessor needs it,
+    // and the accessor fails if that validation does.
+    enum class Validation { Eager, Lazy };
+    bool validate(Validation mode = Validation::Eager);
+
+    // Directory that keeps inflated copies of compressed images, so later
+    // loads of the same file can map them instead of decompressing again.
+    // There is one copy per plugin path, replaced when the plugin changes.
+    // An empty path disables the cache.
+    static void SetDecompressedCacheDir(const char* path);
+
+    // Map plugin files instead of copying them to the heap. Off by default:
+    // plugins are rebuilt in place while loaded, which a mapping does not
+    // survive. Inflated copies in the cache directory are always mapped.
+    static void SetMapPluginFiles(bool map);
 
     const sp_file_hdr_t* hdr() const {
         return hdr_;
@@ -67,8 +87,14 @@ class SmxV1Image : public FileReader
     class Symbol;
     bool GetFunctionAddress(const char* function, const char* file, uint32_t* addr);
     bool GetLineAddress(const uint32_t line, const char* file, uint32_t* addr);
+    bool GetFunctionLineAddresses(uint32_t code_offset, std::vector<uint32_t>* addrs);
     const char* FindFileByPartialName(const char* partialname);
     bool GetVariable(const char* symname, uint32_t scopeaddr, std::unique_ptr<Symbol>& sym);
+    // Indexed lookups over the symbol tables, built once by validate(). The
+    // returned symbols are owned by the image.
+    Symbol* FindVariable(const char* symname, uint32_t scopeaddr);
+    void ForEachLocalSymbol(uint32_t scopeaddr, const std::function<void(Symbol*)>& callback);
+    void ForEachGlobalSymbol(const std::function<void(Symbol*)>& callback);
     const char* GetDebugName(uint32_t nameoffs);
     const char* GetFileName(uint32_t index);
     uint32_t GetFileCount();
@@ -265,6 +291,8 @@ class SmxV1Image : public FileReader
         }
 
         bool Done() {
+            if (!cursor_)
+                return true;
             if (type_ == 1) {
                 return cursor_ + sizeof(sp_fdbg_symbol_t) > cursor_end_;
             } else if (type_ == 0) {
@@ -439,19 +467,24 @@ private:
         return data_;
     }
     const List<sp_file_publics_t>& publics() const {
+        ensure(kGroupTables);
         return publics_;
     }
     const List<sp_file_natives_t>& natives() const {
+        ensure(kGroupTables);
         return natives_;
     }
     const List<sp_file_pubvars_t>& pubvars() const {
+        ensure(kGroupTables);
         return pubvars_;
     }
     const List<sp_file_tag_t>& tags() const {
+        ensure(kGroupTags);
         return tags_;
     }
 
     std::unique_ptr<const debug::RttiData>& rtti_data() {
+        ensure(kGroupRtti);
         return rtti_data_;
     }
   protected:
@@ -473,9 +506,42 @@ private:
     bool validateTags();
 
   private:
+    // Groups of sections validated together, in eager validation order.
+    enum LazyGroup {
+        kGroupTables,    // publics, pubvars, natives
+        kGroupRtti,      // rtti.* tables
+        kGroupDebugInfo, // .dbg.* files, lines, names and symbol tables
+        kGroupTags,
+        kGroupSymbols,   // symbol index over the debug info
+        kGroupCount
+    };
+    bool ensure(LazyGroup group) const;
+    bool validateGroup(LazyGroup group);
+
+    // Trails the inflated image in a cache file and identifies the
+    // compressed file it came from. Size and modification time are checked
+    // first; the checksum is only computed when the time differs.
+    struct CacheKey {
+        uint32_t magic;
+        uint32_t source_size;
+        uint32_t source_crc;
+        uint32_t reserved;
+        int64_t source_mtime;
+    };
+    std::string decompressedCachePath() const;
+    bool loadDecompressedCache(const std::string& path);
+    void storeDecompressedCache(const std::string& path, const CacheKey& key) const;
+    uint32_t sourceChecksum() const;
+    void buildSymbolIndex();
+    int indexLocalScopes();
+
     template <typename SymbolType, typename DimType>
     const char* lookupFunction(const SymbolType* syms, uint32_t addr);
     template <typename SymbolType, typename DimType>
+    bool lookupFunctionRange(const SymbolType* syms, uint32_t addr, uint32_t* start,
+                             uint32_t* end);
+    bool findFunctionRange(uint32_t addr, uint32_t* start, uint32_t* end);
+    template <typename SymbolType, typename DimType>
     bool getFunctionAddress(const SymbolType* syms, const char* name, uint32_t* addr,
                             uint32_t* index);
 
@@ -496,6 +562,8 @@ private:
   private:
     sp_file_hdr_t* hdr_;
     std::string error_;
+    std::string source_path_;
+    int64_t source_mtime_;
     const char* header_strings_;
    std::vector<Section> sections_;
 
@@ -522,12 +590,34 @@ private:
     const smx_rtti_table_header* rtti_fields_ = nullptr;
     const smx_rtti_table_header* rtti_methods_;
     const smx_rtti_table_header* rtti_classdefs_;
-    const smx_rtti_table_header* globals_;
-    const smx_rtti_table_header* locals_;
+    const smx_rtti_table_header* globals_ = nullptr;
+    const smx_rtti_table_header* locals_ = nullptr;
     const smx_rtti_table_header* methods_;
     const smx_rtti_table_header* rtti_enums_;
     const smx_rtti_table_header* rtti_enumstruct_fields_;
     const smx_rtti_table_header* rtti_enumstructs_;
+
+    // Local symbols sorted by codestart, laid out as an implicit interval
+    // tree: node i sits on the level given by its trailing one bits, and
+    // maxend is the largest codeend in its subtree.
+    struct ScopeNode {
+        uint32_t codestart;
+        uint32_t codeend;
+        uint32_t maxend;
+        uint32_t symbol;
+    };
+    struct SymbolName {
+        std::vector<uint32_t> locals; // into local_scopes_, by codestart
+        int32_t global = -1;          // into symbols_
+    };
+    std::vector<Symbol> symbols_;
+    std::vector<ScopeNode> local_scopes_;
+    int local_scopes_level_ = -1;
+    std::vector<uint32_t> global_symbols_;
+    std::unordered_map<std::string_view, SymbolName> symbol_names_;
+
+    mutable std::once_flag group_once_[kGroupCount];
+    mutable bool group_ok_[kGroupCount] = {};
 };
 
 } // namespace sp
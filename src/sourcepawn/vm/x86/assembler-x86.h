@@ -592,6 +592,16 @@ class Assembler : public AssemblerBase
   void ret() {
     emit1(0xc3);
   }
+  // Five-byte nop (nopl 0x0(%eax,%eax,1)), the same size as a near call, so
+  // either can be patched over the other.
+  void nop5() {
+    ensureSpace();
+    *pos_++ = 0x0f;
+    *pos_++ = 0x1f;
+    *pos_++ = 0x44;
+    *pos_++ = 0x00;
+    *pos_++ = 0x00;
+  }
   void ret(int16_t imm) {
     emit1(0xc2);
     writeInt16(imm);
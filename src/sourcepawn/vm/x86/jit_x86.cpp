@@ -133,6 +133,7 @@ bool
 Compiler::visitZERO(cell_t offset)
 {
   __ movl(Operand(dat, offset), 0);
+  emitDataWatch(offset, sizeof(cell_t));
   return true;
 }
 
@@ -388,6 +389,7 @@ bool
 Compiler::visitINC(cell_t offset)
 {
   __ addl(Operand(dat, offset), 1);
+  emitDataWatch(offset, sizeof(cell_t));
   return true;
 }
 
@@ -402,6 +404,7 @@ bool
 Compiler::visitINC_I()
 {
   __ addl(Operand(dat, pri, NoScale), 1);
+  emitDataWatch(pri, sizeof(cell_t));
   return true;
 }
 
@@ -417,6 +420,7 @@ bool
 Compiler::visitDEC(cell_t offset)
 {
   __ subl(Operand(dat, offset), 1);
+  emitDataWatch(offset, sizeof(cell_t));
   return true;
 }
 
@@ -431,6 +435,7 @@ bool
 Compiler::visitDEC_I()
 {
   __ subl(Operand(dat, pri, NoScale), 1);
+  emitDataWatch(pri, sizeof(cell_t));
   return true;
 }
 
@@ -497,6 +502,7 @@ Compiler::visitSTOR(cell_t offset, PawnReg src)
 {
   Register reg = (src == PawnReg::Pri) ? pri : alt;
   __ movl(Operand(dat, offset), reg);
+  emitDataWatch(offset, sizeof(cell_t));
   return true;
 }
 
@@ -521,6 +527,7 @@ Compiler::visitSREF_S(cell_t offset, PawnReg src)
   Register reg = (src == PawnReg::Pri) ? pri : alt;
   __ movl(tmp, Operand(frm, offset));
   __ movl(Operand(dat, tmp, NoScale), reg);
+  emitDataWatch(tmp, sizeof(cell_t));
   return true;
 }
 
@@ -555,6 +562,7 @@ bool
 Compiler::visitCONST(cell_t offset, cell_t value)
 {
   __ movl(Operand(dat, offset), value);
+  emitDataWatch(offset, sizeof(cell_t));
   return true;
 }
 
@@ -578,6 +586,7 @@ Compiler::visitSTOR_I()
 {
   emitCheckAddress(alt);
   __ movl(Operand(dat, alt, NoScale), pri);
+  emitDataWatch(alt, sizeof(cell_t));
   return true;
 }
 
@@ -632,6 +641,7 @@ Compiler::visitSTRB_I(cell_t width)
     __ movw(Operand(dat, alt, NoScale), pri);
   else if (width == 4)
     __ movl(Operand(dat, alt, NoScale), pri);
+  emitDataWatch(alt, width);
   return true;
 }
 
@@ -678,6 +688,7 @@ Compiler::visitMOVS(uint32_t amount)
   }
   __ pop(edi);
   __ pop(esi);
+  emitDataWatch(alt, amount);
   return true;
 }
   
@@ -693,6 +704,7 @@ Compiler::visitFILL(uint32_t amount)
   __ cld();
   __ rep_stosd();
   __ pop(edi);
+  emitDataWatch(alt, amount);
   return true;
 }
 
@@ -1139,6 +1151,24 @@ Compiler::visitBREAK()
   if (!Environment::get()->IsDebugBreakEnabled())
     return true;
 
+  if (Environment::get()->IsDebugBreakPatchable()) {
+    // Emit a site the debugger can patch between a call and a nop, so
+    // unarmed lines cost nothing but a few bytes of decode.
+    ucell_t cip = ucell_t(uintptr_t(op_cip_) - uintptr_t(rt_->code().bytes));
+
+    BreakSite site;
+    site.cipoffs = uintptr_t(op_cip_) - uintptr_t(code_start_);
+    site.pcoffs = masm.pc();
+    site.armed = rt_->IsDebugBreakArmed(cip);
+    if (site.armed)
+      __ call(&debug_break_);
+    else
+      __ nop5();
+    break_sites_.append(site);
+    emitCipMapping(op_cip_);
+    return true;
+  }
+
   __ call(&debug_break_);
   emitCipMapping(op_cip_);
   return true;
@@ -1664,6 +1694,81 @@ Compiler::emitDebugBreakHandler()
   __ ret();
 }
 
+// Data watchpoints: after a store that may reach the data section, compare
+// the written range against the runtime's watched range and call the data
+// watch thunk on overlap. The range is read at run time, so arming and
+// disarming never needs a recompile. Clobbers tmp.
+void
+Compiler::emitDataWatch(Register addr, int32_t size)
+{
+  if (!Environment::get()->IsDataWatchEnabled())
+    return;
+
+  Label done;
+  __ cmpl(addr, Operand(ExternalAddress(rt_->addressOfWatchHi())));
+  __ j(above_equal, &done);
+  __ movl(Operand(ExternalAddress(rt_->addressOfWatchHitAddr())), addr);
+  __ lea(tmp, Operand(addr, size));
+  __ cmpl(tmp, Operand(ExternalAddress(rt_->addressOfWatchLo())));
+  __ j(below_equal, &done);
+  __ movl(Operand(ExternalAddress(rt_->addressOfWatchHitSize())), size);
+  __ call(&data_watch_);
+  emitCipMapping(op_cip_);
+  __ bind(&done);
+}
+
+void
+Compiler::emitDataWatch(cell_t addr, int32_t size)
+{
+  if (!Environment::get()->IsDataWatchEnabled())
+    return;
+
+  Label done;
+  __ cmpl(Operand(ExternalAddress(rt_->addressOfWatchHi())), addr);
+  __ j(below_equal, &done);
+  __ cmpl(Operand(ExternalAddress(rt_->addressOfWatchLo())), addr + size);
+  __ j(above_equal, &done);
+  __ movl(Operand(ExternalAddress(rt_->addressOfWatchHitAddr())), addr);
+  __ movl(Operand(ExternalAddress(rt_->addressOfWatchHitSize())), size);
+  __ call(&data_watch_);
+  emitCipMapping(op_cip_);
+  __ bind(&done);
+}
+
+void
+Compiler::emitDataWatchHandler()
+{
+  __ bind(&data_watch_);
+
+  // Get and store the current stack pointer.
+  __ movl(tmp, stk);
+  __ subl(tmp, dat);
+  __ movl(Operand(spAddr()), tmp);
+
+  // Enter the exit frame. This aligns the stack.
+  __ enterExitFrame(ExitFrameType::Helper, 0);
+
+  // Three arguments, plus room to keep pri and alt: the store may be in
+  // the middle of an expression.
+  static const size_t kStackNeeded = 5 * sizeof(void *);
+  static const size_t kStackReserve = ke::Align(kStackNeeded, 16);
+  __ subl(esp, kStackReserve);
+  __ movl(Operand(esp, 3 * sizeof(void *)), pri);
+  __ movl(Operand(esp, 4 * sizeof(void *)), alt);
+
+  __ movl(tmp, Operand(ExternalAddress(rt_->addressOfWatchHitSize())));
+  __ movl(Operand(esp, 2 * sizeof(void *)), tmp);
+  __ movl(tmp, Operand(ExternalAddress(rt_->addressOfWatchHitAddr())));
+  __ movl(Operand(esp, 1 * sizeof(void *)), tmp);
+  __ movl(Operand(esp, 0 * sizeof(void *)), intptr_t(rt_->GetBaseContext()));
+  __ call(ExternalAddress((void *)InvokeDataWatch));
+
+  __ movl(pri, Operand(esp, 3 * sizeof(void *)));
+  __ movl(alt, Operand(esp, 4 * sizeof(void *)));
+  __ leaveExitFrame();
+  __ ret();
+}
+
 void
 CompilerBase::PatchCallThunk(uint8_t* pc, void* target)
 {
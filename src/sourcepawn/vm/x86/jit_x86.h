@@ -146,10 +146,13 @@ class Compiler : public CompilerBase
   void emitErrorHandlers() override;
   void emitOutOfBoundsErrorPath(OutOfBoundsErrorPath* path) override;
   void emitDebugBreakHandler() override;
+  void emitDataWatchHandler() override;
 
   void emitLegacyNativeCall(uint32_t native_index, NativeEntry* native);
   void emitGenArray(bool autozero);
   void emitCheckAddress(Register reg);
+  void emitDataWatch(Register addr, int32_t size);
+  void emitDataWatch(cell_t addr, int32_t size);
   void emitFloatCmp(ConditionCode cc);
   void emitCallThunk(CallThunk* thunk);
   void jumpOnError(ConditionCode cc, int err = 0);
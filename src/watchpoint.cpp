@@ -0,0 +1,63 @@
+#include "watchpoint.h"
+#include <algorithm>
+
+using namespace sp;
+
+bool WatchpointList::Add(int id, SourcePawn::IPluginContext* ctx,
+	const std::shared_ptr<SmxV1Image>& image, const std::string& expression,
+	std::string* error) {
+	Watchpoint watchpoint = { id, ctx, image, Condition::Parse(expression, error), 0, 0 };
+	if (!watchpoint.expr)
+		return false;
+	if (!watchpoint.expr->Locate(image, ctx, &watchpoint.addr, &watchpoint.size, error))
+		return false;
+	if (!watchpoint.expr->PrintGlobal(image, ctx, &watchpoint.value, error))
+		watchpoint.value = "?";
+
+	watchpoints_.erase(std::remove_if(watchpoints_.begin(), watchpoints_.end(),
+		[id](const Watchpoint& existing) { return existing.id == id; }),
+		watchpoints_.end());
+	watchpoints_.push_back(std::move(watchpoint));
+	return true;
+}
+
+void WatchpointList::Forget(SourcePawn::IPluginContext* ctx) {
+	watchpoints_.erase(std::remove_if(watchpoints_.begin(), watchpoints_.end(),
+		[ctx](const Watchpoint& existing) { return existing.ctx == ctx; }),
+		watchpoints_.end());
+}
+
+void WatchpointList::Collect(RangeMap& ranges) const {
+	for (auto& watchpoint : watchpoints_) {
+		ucell_t lo = watchpoint.addr;
+		ucell_t hi = lo + watchpoint.size;
+		auto inserted = ranges.emplace(watchpoint.ctx, std::make_pair(lo, hi));
+		if (!inserted.second) {
+			auto& range = inserted.first->second;
+			range.first = std::min(range.first, lo);
+			range.second = std::max(range.second, hi);
+		}
+	}
+}
+
+bool WatchpointList::Match(SourcePawn::IPluginContext* ctx, cell_t addr,
+	cell_t size, std::string* text) {
+	bool hit = false;
+	text->clear();
+	for (auto& watchpoint : watchpoints_) {
+		if (watchpoint.ctx != ctx ||
+			addr >= watchpoint.addr + watchpoint.size ||
+			addr + size <= watchpoint.addr)
+			continue;
+
+		std::string value, error;
+		if (!watchpoint.expr->PrintGlobal(watchpoint.image, ctx, &value, &error))
+			value = "?";
+		if (hit)
+			*text += "; ";
+		*text += watchpoint.expr->source() + ": " + watchpoint.value + " -> " + value;
+		watchpoint.value = value;
+		hit = true;
+	}
+	return hit;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#ifndef _INCLUDE_WATCHPOINT_H_
+#define _INCLUDE_WATCHPOINT_H_
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <sp_vm_api.h>
+#include "condition.h"
+#include "smx-v1-image.h"
+
+/**
+ * @brief Data breakpoints of one debugger client.
+ *
+ * A watchpoint names a global, an element of one or a one-dimensional
+ * global array, e.g. "g_iScore[5]", and is resolved once to a range of one
+ * plugin's memory. The VM checks a single range per plugin, the union of
+ * all watchpoints there, so each hit is matched against the individual
+ * watchpoints here. Game thread only.
+ */
+class WatchpointList {
+public:
+	typedef std::unordered_map<SourcePawn::IPluginContext*,
+		std::pair<ucell_t, ucell_t>> RangeMap;
+
+	struct Watchpoint {
+		int id;
+		SourcePawn::IPluginContext* ctx;
+		std::shared_ptr<sp::SmxV1Image> image;
+		std::unique_ptr<Condition> expr;
+		cell_t addr;
+		cell_t size;
+		std::string value; /* as of the last stop, for the stop reason */
+	};
+
+	/**
+	 * @brief Watches an expression in a plugin, replacing the watchpoint
+	 * with the same id.
+	 *
+	 * @param error   Receives a description of the problem on failure.
+	 * @return        False if the expression cannot be watched.
+	 */
+	bool Add(int id, SourcePawn::IPluginContext* ctx,
+		const std::shared_ptr<sp::SmxV1Image>& image,
+		const std::string& expression, std::string* error);
+
+	void Clear() {
+		watchpoints_.clear();
+	}
+
+	/* Drops the watchpoints of an unloaded plugin. */
+	void Forget(SourcePawn::IPluginContext* ctx);
+
+	/* Widens each plugin's [lo, hi) range to cover its watchpoints. */
+	void Collect(RangeMap& ranges) const;
+
+	/**
+	 * @brief Finds the watchpoints a store hit and describes the changes.
+	 * Every overlapping watchpoint takes its new value, so none of them
+	 * reports this store again later.
+	 *
+	 * @param text    Receives e.g. "g_iScore[5]: 3 -> 4; g_iScore: ...".
+	 * @return        False if the store missed all of this list.
+	 */
+	bool Match(SourcePawn::IPluginContext* ctx, cell_t addr, cell_t size,
+		std::string* text);
+
+	bool empty() const {
+		return watchpoints_.empty();
+	}
+
+private:
+	std::vector<Watchpoint> watchpoints_;
+};
+
+#endif //_INCLUDE_WATCHPOINT_H_